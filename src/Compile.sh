@@ -5,7 +5,7 @@ SRC="${1:-tradeshell.c}"
 OUT="${2:-tradeshell}"
 
 CC="${CC:-gcc}"
-CFLAGS="${CFLAGS:-} -O2 -Wall -Wextra"
+CFLAGS="${CFLAGS:-} -O2 -Wall -Wextra -pthread"
 LDFLAGS="${LDFLAGS:-}"
 
 if [[ ! -f "$SRC" ]]; then
@@ -15,6 +15,26 @@ fi
 
 echo "[*] Building: $SRC -> $OUT"
 
+# cmd_lookup() は cmd_table から生成される。古いままならビルドを止める
+# (OL8 の既定は platform-python のみ。どちらも無ければビルドしない)
+GEN="$(dirname "$0")/../tools/gen_cmd_lookup.py"
+PY=""
+if command -v python3 >/dev/null 2>&1; then
+  PY="python3"
+elif [[ -x /usr/libexec/platform-python ]]; then
+  PY="/usr/libexec/platform-python"
+fi
+if [[ -z $PY ]]; then
+  echo "ERROR: python3 not found: needed to check cmd_lookup" >&2
+  echo "    install with: sudo dnf install -y python3" >&2
+  exit 1
+fi
+if [[ ! -f "$GEN" ]]; then
+  echo "ERROR: $GEN not found" >&2
+  exit 1
+fi
+"$PY" "$GEN" --check "$SRC"
+
 has_readline=0
 readline_cflags=""
 readline_libs=""
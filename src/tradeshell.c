@@ -4,7 +4,12 @@
 
   Builtins (parent-only, not pipe-able):
     help, exit, cd, pwd,
-    start, stop, restart, status, health
+    start, stop, restart, status, health, merge-rpmnew,
+    arena, hash, set, stats, trace,
+    jobs, fg, bg, kill
+
+  Prefixes (apply to the whole command or pipeline after them):
+    time, timeout DURATION
 
   Exec-style commands (pipe-able):
     log, config, backup, restore,
@@ -15,23 +20,66 @@
     - Quote support: "..." and '...'
       - Backslash escapes are handled in unquoted and double-quoted strings.
       - Single quotes take everything literally until next '.
+      - A token that is exactly | splits the pipeline even when quoted
+        ("|"), as it always has; a | inside a longer word does not.
     - Pipe support: cmd1 | cmd2 | ...
       - Only exec-style commands are allowed in pipelines.
+    - Background jobs: cmd ... &, then jobs / fg / bg / kill %n.
+    - Lists: cmd1 ; cmd2, cmd1 && cmd2 (on success), cmd1 || cmd2 (on failure).
     - On startup, chdir(HOME) if HOME is set.
+    - start/stop/restart/status call systemd over D-Bus (StartUnit etc.,
+      then wait for JobRemoved); without a usable bus, or after
+      `set dbus off`, they run systemctl instead.
+    - status reads the service's cgroup v2 files and /proc while it runs;
+      `status --full` is always systemctl.
+    - restart --wait [MARKER] times the stop, the start and the wait for
+      the bot's new log (via last_temp.txt) to show MARKER.
     - sudo auto-detect: if `sudo -n true` works, use sudo for systemctl.
       - scat always uses sudo cat
       - update uses sudo when available; otherwise tries without sudo.
+      - `set privhelper on`: sudo runs once, for a root helper that then
+        starts the privileged commands. Off by default: the helper reads
+        any file (scat) and runs the tools with any arguments as root.
+
+  Non-interactive:
+    tradeshell [-e] -c "CMD; CMD..."    run one command line
+    tradeshell [-e] -f SCRIPT|-         run a file (or stdin) line by line
+    -e stops at the first line that fails; the exit code is the last rc.
 
   Build:
-    gcc -O2 -Wall -Wextra -o tradeshell tradeshell.c
+    gcc -O2 -Wall -Wextra -pthread -o tradeshell tradeshell.c
 
   Optional readline:
     sudo dnf install -y readline-devel
-    gcc -O2 -Wall -Wextra -DUSE_READLINE -o tradeshell tradeshell.c -lreadline
+    gcc -O2 -Wall -Wextra -pthread -DUSE_READLINE -o tradeshell tradeshell.c -lreadline
 */
 
+#define _GNU_SOURCE
 #include <sys/wait.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/signalfd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <pthread.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
+#include <sys/statvfs.h>
+#include <sys/sysmacros.h>
+#include <sys/timex.h>
+#include <regex.h>
+#include <pwd.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -40,38 +88,192 @@
 #include <dirent.h>
 #include <ctype.h>
 #include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
 #ifdef USE_READLINE
 #include <readline/readline.h>
 #include <readline/history.h>
 #endif
 
 // ====== fixed commands / paths ======
-static const char *SERVICE_NAME = "fx-autotrade";
-
-static const char *SYSTEMCTL = "systemctl";
-static const char *PYTHON3   = "python3";
-static const char *BASH      = "bash";
-static const char *NANO      = "nano";
-static const char *LS        = "ls";
-static const char *CAT       = "cat";
-static const char *GREP      = "grep";
-static const char *SYNC = "sync";
-
-static const char *LOG_TOOL     = "/opt/Innovations/System/tools/get_log.py";
-static const char *CONFIG_TOOL  = "/opt/Innovations/System/tools/xmledit.py";
-static const char *BACKUP_TOOL  = "/opt/Innovations/System/tools/Buckup.py";
-static const char *RESTORE_TOOL = "/opt/Innovations/System/tools/Restore.py";
-static const char *UPDATE_TOOL  = "/opt/Innovations/System/Update.sh";
-
-static const char *SUDO = "sudo";
-static int g_use_sudo = 0;
+static const char SERVICE_NAME[] = "fx-autotrade";
+
+static const char SYSTEMCTL[] = "systemctl";
+static const char PYTHON3[]   = "python3";
+static const char BASH[]      = "bash";
+static const char NANO[]      = "nano";
+static const char LS[]        = "ls";
+static const char CAT[]       = "cat";
+static const char GREP[]      = "grep";
+static const char SYNC[]      = "sync";
+static const char YUM[]       = "yum";
+
+static const char LOG_TOOL[]     = "/opt/Innovations/System/tools/get_log.py";
+static const char CONFIG_TOOL[]  = "/opt/Innovations/System/tools/xmledit.py";
+static const char BACKUP_TOOL[]  = "/opt/Innovations/System/tools/Buckup.py";
+static const char RESTORE_TOOL[] = "/opt/Innovations/System/tools/Restore.py";
+static const char UPDATE_TOOL[]  = "/opt/Innovations/System/Update.sh";
+static const char LAST_TEMP_FILE[] = "/opt/Innovations/System/last_temp/last_temp.txt";
+static const char DEBUG_LOG_NAME[] = "fx_debug_log.txt";  // in the dir last_temp.txt names
+
+static const char SUDO[] = "sudo";
+static int g_use_sudo = -1;     // -1 = not probed yet
+static int g_errexit = 0;       // -e: stop at the first failing list
 // ===================================
 
+// ====== shell options (`set`) ======
+static struct {
+  long pipe_size;        // bytes per pipeline pipe, 0 = kernel default
+  long pipefail;         // pipeline rc = rightmost failing stage
+  long timeout_ms;       // every spawned command, 0 = none
+  long privtimeout_ms;   // commands run through sudo, 0 = none
+  long privhelper;       // run allowlisted sudo commands via one root helper
+  long dbus;             // start/stop/restart/status over the system bus
+  long readytimeout_ms;  // restart --wait: stop to ready, 0 = none
+} g_opt = {
+  .pipe_size = 1 << 20,
+  .privtimeout_ms = 600 * 1000,
+  .readytimeout_ms = 120 * 1000,
+  .dbus = 1,
+};
+
+static int g_last_rc = 0;           // rc of the last command or pipeline
+static long g_cmd_deadline_ns = 0;  // `timeout N` prefix for this line, 0 = none
+static const char *g_cmd_name;      // command being run, for reports
+
+// Job control is on when stdin is a terminal: every command runs in its
+// own process group, which gets the terminal while in the foreground.
+static int g_jc = 0;
+static int g_exit_requested = 0;    // `exit` ran; leave after this line
+static volatile sig_atomic_t g_interrupted;   // SIGINT while the shell had the terminal
+static volatile sig_atomic_t g_child_event;   // SIGCHLD or zygote report since last reap
+static int g_chld_pipe[2] = { -1, -1 };       // SIGCHLD self-pipe, for epoll
+
+// ====== per-line arena ======
+// Everything derived from one command line (tokens, argv arrays, pipeline
+// bookkeeping) is bump-allocated here and released at once by
+// arena_reset() after execute_line(). Chunks are kept across lines;
+// only oversized blocks are returned to malloc on reset.
+#define ARENA_CHUNK_SIZE  (64 * 1024)
+#define ARENA_ALIGN       16
+
+typedef struct arena_chunk {
+  struct arena_chunk *next;
+  size_t cap;
+  size_t used;
+  char data[];
+} arena_chunk;
+
+typedef struct {
+  arena_chunk *first;   // chunk list kept across resets
+  arena_chunk *cur;     // chunk currently being filled
+  arena_chunk *big;     // oversized blocks, freed on reset
+
+  // counters (session totals)
+  unsigned long lines;
+  unsigned long allocs;      // served from the arena = malloc/free pairs avoided
+  unsigned long bytes;
+  size_t line_bytes;         // bytes used by the current line
+  size_t peak_line_bytes;
+  int chunks;
+} arena;
+
+static arena g_arena;
+
+static arena_chunk *arena_new_chunk(size_t cap)
+{
+  arena_chunk *c = malloc(sizeof(arena_chunk) + cap);
+  if (!c) return NULL;
+  c->next = NULL;
+  c->cap = cap;
+  c->used = 0;
+  return c;
+}
+
+static void *arena_alloc(arena *a, size_t n)
+{
+  if (n == 0) n = 1;
+  n = (n + (ARENA_ALIGN - 1)) & ~(size_t)(ARENA_ALIGN - 1);
+
+  if (n > ARENA_CHUNK_SIZE / 4) {
+    arena_chunk *b = arena_new_chunk(n);
+    if (!b) return NULL;
+    b->next = a->big;
+    a->big = b;
+    b->used = n;
+    a->allocs++;
+    a->bytes += n;
+    a->line_bytes += n;
+    return b->data;
+  }
+
+  if (!a->cur) {
+    if (!a->first) {
+      a->first = arena_new_chunk(ARENA_CHUNK_SIZE);
+      if (!a->first) return NULL;
+      a->chunks++;
+    }
+    a->cur = a->first;
+  }
+
+  while (a->cur->cap - a->cur->used < n) {
+    if (!a->cur->next) {
+      a->cur->next = arena_new_chunk(ARENA_CHUNK_SIZE);
+      if (!a->cur->next) return NULL;
+      a->chunks++;
+    }
+    a->cur = a->cur->next;
+    a->cur->used = 0;
+  }
+
+  void *p = a->cur->data + a->cur->used;
+  a->cur->used += n;
+  a->allocs++;
+  a->bytes += n;
+  a->line_bytes += n;
+  return p;
+}
+
+static void *arena_calloc(arena *a, size_t n, size_t size)
+{
+  if (size != 0 && n > SIZE_MAX / size) return NULL;
+  void *p = arena_alloc(a, n * size);
+  if (p) memset(p, 0, n * size);
+  return p;
+}
+
+// O(1) in the common case: rewind to the first chunk.
+static void arena_reset(arena *a)
+{
+  while (a->big) {
+    arena_chunk *n = a->big->next;
+    free(a->big);
+    a->big = n;
+  }
+  if (a->first) a->first->used = 0;
+  a->cur = a->first;
+
+  if (a->line_bytes > a->peak_line_bytes) a->peak_line_bytes = a->line_bytes;
+  a->line_bytes = 0;
+  a->lines++;
+}
+
 // ====== helpers ======
 static int run_cmd_capture_rc(char *const argv[]);
+static int proc_wait_timed(pid_t pid, char *const argv[]);
 static void detect_sudo(void);
 static void print_usage(void);
 static int sh_merge_rpmnew(char **args);
+static int sh_jobs(char **args);
+static int sh_fg(char **args);
+static int sh_bg(char **args);
+static int sh_kill(char **args);
+static int sh_health(char **args);
 
 static char *trim_ws(char *s);
 static int ends_with(const char *s, const char *suffix);
@@ -87,484 +289,3787 @@ static int run_cmd_capture_rc(char *const argv[]);
 static void detect_sudo(void);
 static void print_usage(void);
 
-// ====== exec argv builder (passthrough) ======
-static void build_passthrough_argv(char **args,
-                                   const char *prefix0,
-                                   const char *prefix1,
-                                   char ***out_argv)
-{
-  int count = 0;
-  while (args[count] != NULL) count++;
-
-  // ★ sudoを常に追加
-  int prefix_count = 1 + (prefix0 ? 1 : 0) + (prefix1 ? 1 : 0);
-  int total = prefix_count + (count - 1) + 1;
+// ====== command registry ======
+// One table describes every command: builtins run in the parent, exec-style
+// commands are turned into an argv from a fixed prefix template plus the
+// user's arguments. cmd_lookup() maps a name to its entry in O(1).
+typedef enum {
+  CMD_PARENT_BUILTIN,   // help/exit/cd/pwd/start/stop...
+  CMD_EXEC_ALLOWED,     // can exec (and pipe)
+  CMD_UNKNOWN
+} cmd_kind;
 
-  char **argv = calloc((size_t)total, sizeof(char*));
-  if (!argv) {
-    perror("trade: calloc");
-    *out_argv = NULL;
-    return;
-  }
+typedef enum {
+  SUDO_NEVER,
+  SUDO_IF_AVAILABLE,    // prepend sudo when detect_sudo() succeeds
+  SUDO_ALWAYS,
+} sudo_policy;
 
-  int i = 0;
+typedef enum {
+  CMD_HELP, CMD_EXIT, CMD_CD, CMD_PWD,
+  CMD_START, CMD_STOP, CMD_RESTART, CMD_STATUS, CMD_HEALTH,
+  CMD_MERGE_RPMNEW, CMD_ARENA, CMD_HASH, CMD_SET, CMD_STATS, CMD_TRACE,
+  CMD_JOBS, CMD_FG, CMD_BG, CMD_KILL,
+  CMD_LOG, CMD_CONFIG, CMD_BACKUP, CMD_RESTORE,
+  CMD_NANO, CMD_LS, CMD_CAT, CMD_GREP, CMD_SCAT,
+  CMD_UPDATE, CMD_SYNC, CMD_INSTALL,
+  CMD_NCOMMANDS
+} cmd_id;
+
+#define CMD_MAX_PREFIX 4
+
+typedef struct cmd_entry cmd_entry;
+typedef struct native_stage native_stage;
+struct cmd_entry {
+  const char *name;
+  cmd_kind kind;
+  // CMD_PARENT_BUILTIN: runs in the shell process.
+  int (*builtin)(char **args);
+  // CMD_EXEC_ALLOWED: optional custom argv builder; NULL means
+  // prefix + args[1..].
+  cmd_kind (*build)(const cmd_entry *e, char **args, char ***argv_out);
+  // Optional in-process implementation. Returns 1 and fills *st when it
+  // can run these args itself, 0 to fall back to the exec argv.
+  int (*native)(char **args, native_stage *st);
+  // argv template (without sudo); systemctl builtins use it too.
+  const char *prefix[CMD_MAX_PREFIX + 1];
+  sudo_policy sudo;
+};
 
-  // ★ 常にsudo
-  argv[i++] = (char*)SUDO;
+// Resolved prefix per command ([sudo] + template), built on first use by
+// cmd_prefix_get() and never modified afterwards.
+typedef struct {
+  char **argv;
+  int len;
+} cmd_prefix;
 
-  if (prefix0) argv[i++] = (char*)prefix0;
-  if (prefix1) argv[i++] = (char*)prefix1;
+static const cmd_entry cmd_table[CMD_NCOMMANDS];
+static cmd_prefix g_cmd_prefix[CMD_NCOMMANDS];
 
-  for (int j = 1; j < count; j++) argv[i++] = args[j];
-  argv[i] = NULL;
+static const cmd_entry *cmd_lookup(const char *name);
+static char **cmd_build_argv(const cmd_entry *e, char **extra);
 
-  *out_argv = argv;
-}
+// ====== executable path cache ======
+// Fixed binaries are resolved against PATH once and exec'd with execve()
+// directly, instead of execvp() retrying execve() per PATH entry on every
+// spawn. An inotify watch on the resolved files and the PATH directories
+// invalidates the cache; without inotify the inode/mtime is re-checked.
+#define EXE_CACHE_MAX 32
 
-static int run_cmd_capture_rc(char *const argv[])
+typedef struct {
+  char *name;
+  char path[PATH_MAX];     // "" when not found
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime;
+  int valid;
+  unsigned long hits;
+  unsigned long resolves;
+  int probes;              // PATH entries tried before the match
+  long resolve_ns;         // cost of the last PATH walk
+} exe_cache_entry;
+
+static exe_cache_entry g_exe_cache[EXE_CACHE_MAX];
+static int g_exe_cache_len = 0;
+static int g_exe_inotify = -1;
+
+static long elapsed_ns(const struct timespec *a, const struct timespec *b)
 {
-  pid_t pid = fork();
-  if (pid == 0) {
-    execvp(argv[0], argv);
-    fprintf(stderr, "trade: execvp failed: %s (%s)\n", argv[0], strerror(errno));
-    _exit(127);
-  } else if (pid < 0) {
-    perror("trade: fork");
-    return 1;
-  } else {
-    int status = 0;
-    if (waitpid(pid, &status, 0) < 0) {
-      perror("trade: waitpid");
-      return 1;
-    }
-    if (WIFEXITED(status)) return WEXITSTATUS(status);
-    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
-    return 1;
-  }
+  return (long)(b->tv_sec - a->tv_sec) * 1000000000L + (b->tv_nsec - a->tv_nsec);
 }
 
-static void detect_sudo(void)
+static void exe_cache_invalidate_all(void)
 {
-  char *const argv[] = {(char*)SUDO, "-n", "true", NULL};
-  int rc = run_cmd_capture_rc(argv);
-  g_use_sudo = (rc == 0);
+  for (int i = 0; i < g_exe_cache_len; i++) g_exe_cache[i].valid = 0;
 }
 
-static void print_usage(void)
+// Drain pending inotify events; any event drops every entry.
+static void exe_cache_poll(void)
 {
-  puts("AutoTrade Shell (Oracle Linux)");
-  puts("Commands:");
-  puts("  help                  show this help");
-  puts("  exit                  quit");
-  puts("  cd [DIR]              change directory (default: HOME; supports ~ and ~/...)");
-  puts("  pwd                   print current directory");
-  puts("");
-  puts("  start                 [sudo] systemctl start fx-autotrade");
-  puts("  stop                  [sudo] systemctl stop fx-autotrade");
-  puts("  restart               [sudo] systemctl restart fx-autotrade");
-  puts("  status                [sudo] systemctl status fx-autotrade");
-  puts("  health                service + log + disk + mem + time");
-  puts("");
-  puts("  log [ARGS...]         python3 /opt/Innovations/System/tools/get_log.py [ARGS...]");
-  puts("  config [ARGS...]      python3 /opt/Innovations/System/tools/xmledit.py [ARGS...]");
-  puts("  backup [ARGS...]      python3 /opt/Innovations/System/tools/Buckup.py [ARGS...]");
-  puts("  restore [ARGS...]     python3 /opt/Innovations/System/tools/Restore.py [ARGS...]");
-  puts("  update [ARGS...]      [sudo] bash /opt/Innovations/System/Update.sh [ARGS...]");
-  puts("  merge-rpmnew         add only new keys from /etc/AutoTrade/*.rpmnew");
-  puts("");
-  puts("  nano [ARGS...]        nano [ARGS...]");
-  puts("  ls [ARGS...]          ls [ARGS...]");
-  puts("  cat [ARGS...]         cat [ARGS...]");
-  puts("  scat [ARGS...]        sudo cat [ARGS...]");
-  puts("  grep [ARGS...]        grep [ARGS...]");
-  puts("");
-  puts("Pipes:");
-  puts("  cat file | grep KEYWORD");
-  puts("");
-  puts("Quotes:");
-  puts("  cat \"file name.txt\" | grep \"some word\"");
-  puts("");
-  puts("Notes:");
-  puts("  - Only exec-style commands can be used in pipelines.");
-  puts("  - systemctl uses sudo when available (sudo -n true).");
+  if (g_exe_inotify < 0) return;
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  int changed = 0;
+  while (read(g_exe_inotify, buf, sizeof(buf)) > 0) changed = 1;
+  if (changed) exe_cache_invalidate_all();
 }
 
-// ====== builtins (parent-only) ======
-static int sh_help(char **args) { (void)args; print_usage(); return 1; }
-static int sh_exit(char **args) { (void)args; return 0; }
-
-
-static char *trim_ws(char *s)
+static void exe_resolve(exe_cache_entry *e)
 {
-  while (*s && isspace((unsigned char)*s)) s++;
-  if (*s == '\0') return s;
-
-  char *end = s + strlen(s) - 1;
-  while (end > s && isspace((unsigned char)*end)) {
-    *end = '\0';
-    end--;
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  const char *path = getenv("PATH");
+  if (!path || !*path) path = "/bin:/usr/bin";
+
+  e->path[0] = '\0';
+  e->probes = 0;
+  const char *p = path;
+  while (1) {
+    const char *colon = strchr(p, ':');
+    size_t dlen = colon ? (size_t)(colon - p) : strlen(p);
+    char cand[PATH_MAX];
+    int n = (dlen == 0)
+      ? snprintf(cand, sizeof(cand), "%s", e->name)
+      : snprintf(cand, sizeof(cand), "%.*s/%s", (int)dlen, p, e->name);
+
+    struct stat st;
+    if (n > 0 && (size_t)n < sizeof(cand) &&
+        stat(cand, &st) == 0 && S_ISREG(st.st_mode) && access(cand, X_OK) == 0) {
+      memcpy(e->path, cand, (size_t)n + 1);
+      e->dev = st.st_dev;
+      e->ino = st.st_ino;
+      e->mtime = st.st_mtim;
+      if (g_exe_inotify >= 0) {
+        (void)inotify_add_watch(g_exe_inotify, cand,
+                                IN_ATTRIB | IN_MODIFY | IN_DELETE_SELF | IN_MOVE_SELF);
+      }
+      break;
+    }
+    e->probes++;
+    if (!colon) break;
+    p = colon + 1;
   }
-  return s;
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  e->resolve_ns = elapsed_ns(&t0, &t1);
+  e->resolves++;
+  e->valid = 1;
 }
 
-static int ends_with(const char *s, const char *suffix)
+// Without inotify: re-resolve when the file was replaced or touched.
+static int exe_cache_stale(const exe_cache_entry *e)
 {
-  size_t ls = strlen(s);
-  size_t lf = strlen(suffix);
-  if (ls < lf) return 0;
-  return strcmp(s + (ls - lf), suffix) == 0;
+  if (g_exe_inotify >= 0 || e->path[0] == '\0') return 0;
+  struct stat st;
+  if (stat(e->path, &st) != 0) return 1;
+  return st.st_dev != e->dev || st.st_ino != e->ino ||
+         st.st_mtim.tv_sec != e->mtime.tv_sec || st.st_mtim.tv_nsec != e->mtime.tv_nsec;
 }
 
-static int split_key_value(const char *line,
-                           char *keybuf, size_t keybuf_sz,
-                           char *valbuf, size_t valbuf_sz)
+// Absolute path for `name`, or NULL (exec through execvp as before).
+static const char *exe_lookup(const char *name)
 {
-  if (!line || !keybuf || !valbuf || keybuf_sz == 0 || valbuf_sz == 0) return 0;
+  if (!name || strchr(name, '/')) return NULL;
 
-  char tmp[4096];
-  snprintf(tmp, sizeof(tmp), "%s", line);
+  exe_cache_poll();
 
-  char *p = trim_ws(tmp);
-  if (*p == '\0' || *p == '#') return 0;
-  if (strchr(p, '<') != NULL || strchr(p, '>') != NULL) {
-      return 0;
+  exe_cache_entry *e = NULL;
+  for (int i = 0; i < g_exe_cache_len; i++) {
+    if (strcmp(g_exe_cache[i].name, name) == 0) { e = &g_exe_cache[i]; break; }
+  }
+  if (!e) {
+    if (g_exe_cache_len == EXE_CACHE_MAX) return NULL;
+    char *dup = strdup(name);
+    if (!dup) return NULL;
+    e = &g_exe_cache[g_exe_cache_len++];
+    memset(e, 0, sizeof(*e));
+    e->name = dup;
   }
-  char *eq = strchr(p, '=');
-  if (!eq) return 0;
-
-  *eq = '\0';
-  char *key = trim_ws(p);
-  char *val = trim_ws(eq + 1);
 
-  if (*key == '\0') return 0;
+  if (!e->valid || exe_cache_stale(e)) exe_resolve(e);
+  else e->hits++;
 
-  snprintf(keybuf, keybuf_sz, "%s", key);
-  snprintf(valbuf, valbuf_sz, "%s", val);
-  return 1;
+  return e->path[0] ? e->path : NULL;
 }
 
-static int find_key_value_in_file(const char *path, const char *target_key,
-                                  char *valbuf, size_t valbuf_sz)
+// Scripts (-c/-f) skip inotify and the warm-up: tearing down the watches
+// at exit costs more (~7 ms) than a short run saves, and the stat check
+// in exe_cache_stale() keeps the cache correct without them.
+static void exe_cache_init(int interactive)
 {
-  FILE *fp = fopen(path, "r");
-  if (!fp) return 0;
+  if (!interactive) return;
+  g_exe_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+  // new binaries appearing earlier in PATH must win, as with execvp
+  if (g_exe_inotify >= 0) {
+    const char *path = getenv("PATH");
+    char dirs[4096];
+    snprintf(dirs, sizeof(dirs), "%s", (path && *path) ? path : "/bin:/usr/bin");
+    for (char *save = NULL, *d = strtok_r(dirs, ":", &save); d; d = strtok_r(NULL, ":", &save)) {
+      (void)inotify_add_watch(g_exe_inotify, d,
+                              IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM | IN_ATTRIB);
+    }
+  }
 
-  char line[4096];
-  char key[1024];
-  char val[4096];
-  int found = 0;
+  static const char *const fixed[] = {
+    SYSTEMCTL, PYTHON3, BASH, NANO, LS, CAT, GREP, SUDO, SYNC,
+  };
+  for (size_t i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++) {
+    (void)exe_lookup(fixed[i]);
+  }
+}
 
-  while (fgets(line, sizeof(line), fp)) {
-    if (!split_key_value(line, key, sizeof(key), val, sizeof(val))) {
-      continue;
-    }
+// ====== zygote ======
+// Optional (TRADE_ZYGOTE=1): a helper forked at startup, while the shell
+// is still small, that forks and execs commands on request. Requests go
+// over a SOCK_SEQPACKET socketpair: path and argv in the payload, the
+// cwd and stdin/stdout/stderr as SCM_RIGHTS fds. The zygote answers with
+// the pid (or exec errno) and later with the wait status and rusage;
+// stops and continues of a child are reported as they happen.
+#define ZY_MAX_PAYLOAD (64 * 1024)
+#define ZY_NFDS 4              // cwd, stdin, stdout, stderr
+#define ZY_MAX_CHILDREN 64
 
-    if (strcmp(key, target_key) == 0) {
-      snprintf(valbuf, valbuf_sz, "%s", val);
-      found = 1;
-      break;
-    }
+enum { ZY_SPAWN = 1, ZY_SPAWNED, ZY_EXIT, ZY_STOP, ZY_KILL };
+
+typedef struct {
+  uint32_t type;
+  int32_t pid;
+  int32_t err;                 // ZY_SPAWNED: exec errno, 0 on success
+  int32_t status;              // ZY_EXIT, ZY_STOP: wait status; ZY_KILL: signal
+  int32_t pgid;                // ZY_SPAWN: -1 = the zygote's group, 0 = new
+  struct rusage ru;            // ZY_EXIT
+  uint32_t argc;               // ZY_SPAWN: strings in payload after path
+  uint32_t len;                // ZY_SPAWN: payload bytes
+} zy_msg;
+
+// One spawner at the other end of a socket: the zygote, or the root
+// helper (see the privileged helper section).
+typedef struct {
+  int fd;
+  pid_t pid;                   // ours to reap: the zygote, or sudo
+  int priv;
+} zy_chan;
+
+typedef struct {
+  pid_t pid;
+  zy_chan *ch;
+  int done;
+  int stopped;                 // stop signal while stopped, else 0
+  int status;
+  struct rusage ru;
+} zy_child;
+
+static zy_chan g_zy = { .fd = -1, .pid = -1 };
+static zy_chan g_priv = { .fd = -1, .pid = -1, .priv = 1 };
+static zy_child g_zy_children[ZY_MAX_CHILDREN];
+
+static ssize_t zy_send(int sock, const zy_msg *m, const char *payload, const int *fds, int nfds)
+{
+  struct iovec iov[2] = {
+    { .iov_base = (void *)m, .iov_len = sizeof(*m) },
+    { .iov_base = (void *)payload, .iov_len = payload ? m->len : 0 },
+  };
+  union {
+    char buf[CMSG_SPACE(sizeof(int) * ZY_NFDS)];
+    struct cmsghdr align;
+  } cm;
+  struct msghdr mh = { .msg_iov = iov, .msg_iovlen = payload ? 2 : 1 };
+  if (nfds > 0) {
+    memset(&cm, 0, sizeof(cm));
+    mh.msg_control = cm.buf;
+    mh.msg_controllen = CMSG_SPACE(sizeof(int) * (size_t)nfds);
+    struct cmsghdr *c = CMSG_FIRSTHDR(&mh);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int) * (size_t)nfds);
+    memcpy(CMSG_DATA(c), fds, sizeof(int) * (size_t)nfds);
   }
+  ssize_t n;
+  do n = sendmsg(sock, &mh, MSG_NOSIGNAL); while (n < 0 && errno == EINTR);
+  return n;
+}
 
-  fclose(fp);
-  return found;
+// Returns bytes received (0 on EOF); received fds are O_CLOEXEC.
+static ssize_t zy_recv(int sock, zy_msg *m, char *payload, size_t cap, int *fds, int *nfds)
+{
+  struct iovec iov[2] = {
+    { .iov_base = m, .iov_len = sizeof(*m) },
+    { .iov_base = payload, .iov_len = cap },
+  };
+  union {
+    char buf[CMSG_SPACE(sizeof(int) * ZY_NFDS)];
+    struct cmsghdr align;
+  } cm;
+  struct msghdr mh = {
+    .msg_iov = iov, .msg_iovlen = payload ? 2 : 1,
+    .msg_control = cm.buf, .msg_controllen = sizeof(cm.buf),
+  };
+  ssize_t n;
+  do n = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC); while (n < 0 && errno == EINTR);
+
+  if (nfds) *nfds = 0;
+  if (n > 0) {
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&mh); c; c = CMSG_NXTHDR(&mh, c)) {
+      if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+      int k = (int)((c->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+      int got[ZY_NFDS];
+      if (k > ZY_NFDS) k = ZY_NFDS;
+      memcpy(got, CMSG_DATA(c), sizeof(int) * (size_t)k);
+      if (fds && nfds) { memcpy(fds, got, sizeof(int) * (size_t)k); *nfds = k; }
+      else for (int i = 0; i < k; i++) close(got[i]);
+    }
+  }
+  return n;
 }
 
-static int merge_rpmnew_file(const char *orig_path, const char *rpmnew_path)
+static int priv_allowed(char *const argv[], uid_t uid);
+static uid_t g_priv_uid;
+
+// Returns the child's pid, or -1.
+static pid_t zygote_spawn_one(int sock, const zy_msg *req, char *payload, const int *fds, int nfds,
+                              int priv)
 {
-  FILE *src = fopen(rpmnew_path, "r");
-  if (!src) {
-    fprintf(stderr, "trade: merge: cannot open rpmnew: %s (%s)\n",
-            rpmnew_path, strerror(errno));
-    return 1;
+  zy_msg rep = { .type = ZY_SPAWNED, .pid = -1 };
+
+  char *argv[1024];
+  char *path = payload;
+  char *p = payload + strlen(payload) + 1;
+  uint32_t argc = req->argc < 1023 ? req->argc : 1023;
+  for (uint32_t i = 0; i < argc; i++) { argv[i] = p; p += strlen(p) + 1; }
+  argv[argc] = NULL;
+  int32_t pgid = req->pgid;
+
+  // the root helper does not trust the shell: allowlisted commands only,
+  // found on its own PATH, run from / rather than the shell's cwd, each
+  // in a session of its own (so the user's terminal, passed as an fd, is
+  // never its controlling terminal)
+  if (priv && argc > 0) {
+    path = argv[0];
+    pgid = -1;
   }
 
-  FILE *dst = fopen(orig_path, "a");
-  if (!dst) {
-    fclose(src);
-    fprintf(stderr, "trade: merge: cannot open original: %s (%s)\n",
-            orig_path, strerror(errno));
-    return 1;
+  int err = (nfds != ZY_NFDS || argc == 0) ? EINVAL : (priv && priv_allowed(argv, g_priv_uid) < 0) ? EPERM : 0;
+  int errpipe[2];
+  if (!err && pipe2(errpipe, O_CLOEXEC) != 0) err = errno;
+  if (err) {
+    rep.err = err;
+    zy_send(sock, &rep, NULL, NULL, 0);
+    return -1;
   }
 
-  char line[4096];
-  char key[1024];
-  char rpmnew_val[4096];
-  char orig_val[4096];
-  int added = 0;
+  pid_t pid = fork();
+  if (pid == 0) {
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    if (priv) setsid();
+    else if (pgid >= 0) setpgid(0, pgid);
+
+    if ((priv ? chdir("/") : fchdir(fds[0])) != 0 ||
+        dup2(fds[1], STDIN_FILENO) < 0 ||
+        dup2(fds[2], STDOUT_FILENO) < 0 ||
+        dup2(fds[3], STDERR_FILENO) < 0) {
+      int e = errno;
+      (void)!write(errpipe[1], &e, sizeof(e));
+      _exit(127);
+    }
+    if (strchr(path, '/')) execve(path, argv, environ);
+    else execvp(path, argv);
+    int e = errno;
+    (void)!write(errpipe[1], &e, sizeof(e));
+    _exit(127);
+  }
+  close(errpipe[1]);
+  // also from this side, so the group exists before the next stage joins
+  if (pid > 0 && pgid >= 0) setpgid(pid, pgid ? pgid : pid);
 
-  while (fgets(line, sizeof(line), src)) {
-    if (!split_key_value(line, key, sizeof(key), rpmnew_val, sizeof(rpmnew_val))) {
-      continue;
+  if (pid < 0) {
+    rep.err = errno;
+  } else {
+    int e = 0;
+    ssize_t n;
+    do n = read(errpipe[0], &e, sizeof(e)); while (n < 0 && errno == EINTR);
+    rep.pid = pid;
+    rep.err = (n == (ssize_t)sizeof(e)) ? e : 0;
+  }
+  close(errpipe[0]);
+  zy_send(sock, &rep, NULL, NULL, 0);
+  return rep.err ? -1 : pid;
+}
+
+// `priv`: the root helper. It also takes ZY_KILL for its own children
+// (the shell may not signal them), and when the shell goes away it lets
+// running children finish, as they would under sudo, before exiting.
+__attribute__((noreturn))
+static void zygote_main(int sock, int priv)
+{
+  signal(SIGINT, SIG_IGN);
+  signal(SIGQUIT, SIG_IGN);
+  signal(SIGTSTP, SIG_IGN);
+
+  sigset_t chld;
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &chld, NULL);
+  int sfd = signalfd(-1, &chld, SFD_NONBLOCK | SFD_CLOEXEC);
+
+  static char payload[ZY_MAX_PAYLOAD];
+  static pid_t kids[ZY_MAX_CHILDREN];   // priv: live children
+  int nkids = 0, eof = 0;
+  for (;;) {
+    struct pollfd pf[2] = {
+      { .fd = eof ? -1 : sock, .events = POLLIN },
+      { .fd = sfd,  .events = POLLIN },
+    };
+    if (poll(pf, sfd >= 0 ? 2 : 1, -1) < 0) {
+      if (errno == EINTR) continue;
+      _exit(1);
     }
 
-    if (find_key_value_in_file(orig_path, key, orig_val, sizeof(orig_val))) {
-      if (strcmp(orig_val, rpmnew_val) != 0) {
-        printf("trade: merge: changed key skipped '%s'\n", key);
+    if (sfd >= 0 && (pf[1].revents & POLLIN)) {
+      struct signalfd_siginfo si;
+      while (read(sfd, &si, sizeof(si)) > 0) {}
+      int status;
+      struct rusage ru;
+      pid_t pid;
+      while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &ru)) > 0) {
+        int alive = WIFSTOPPED(status) || WIFCONTINUED(status);
+        zy_msg m = { .type = alive ? ZY_STOP : ZY_EXIT, .pid = pid, .status = status, .ru = ru };
+        if (!eof) zy_send(sock, &m, NULL, NULL, 0);
+        for (int i = 0; !alive && i < nkids; i++) {
+          if (kids[i] == pid) { kids[i] = kids[--nkids]; break; }
+        }
       }
-      continue;
+      if (eof && nkids == 0) _exit(0);
     }
 
-    fprintf(dst, "\n%s", line);
-    if (line[strlen(line) - 1] != '\n') {
-      fputc('\n', dst);
+    if (pf[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+      zy_msg m;
+      int fds[ZY_NFDS];
+      int nfds = 0;
+      ssize_t n = zy_recv(sock, &m, payload, sizeof(payload) - 1, fds, &nfds);
+      if (n <= 0) {           // shell went away
+        if (!priv || nkids == 0 || sfd < 0) _exit(0);
+        eof = 1;
+        continue;
+      }
+      payload[n - (ssize_t)sizeof(m) > 0 ? n - (ssize_t)sizeof(m) : 0] = '\0';
+      if (m.type == ZY_SPAWN && (size_t)n >= sizeof(m)) {
+        pid_t pid = zygote_spawn_one(sock, &m, payload, fds, nfds, priv);
+        if (priv && pid > 0 && nkids < ZY_MAX_CHILDREN) kids[nkids++] = pid;
+      } else if (m.type == ZY_KILL && priv && m.pid != 0) {
+        pid_t who = m.pid < 0 ? -m.pid : m.pid;
+        for (int i = 0; i < nkids; i++) {
+          if (kids[i] == who) { kill(m.pid, m.status); break; }
+        }
+      }
+      for (int i = 0; i < nfds; i++) close(fds[i]);
     }
-    added++;
-    printf("trade: merge: added key '%s' to %s\n", key, orig_path);
   }
+}
 
-  fclose(src);
-  fclose(dst);
+// Fork the zygote; must run before readline or anything else grows the
+// shell. Failure just leaves spawning local.
+static void zygote_start(void)
+{
+  const char *env = getenv("TRADE_ZYGOTE");
+  if (!env || strcmp(env, "1") != 0) return;
 
-  if (added > 0) {
-  char merged_path[PATH_MAX];
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0) {
+    perror("trade: zygote: socketpair");
+    return;
+  }
+  fflush(NULL);
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("trade: zygote: fork");
+    close(sv[0]); close(sv[1]);
+    return;
+  }
+  if (pid == 0) {
+    close(sv[0]);
+    zygote_main(sv[1], 0);
+  }
+  close(sv[1]);
+  g_zy.fd = sv[0];
+  g_zy.pid = pid;
+}
 
-  // ".merged" 分の余裕チェック（7文字 + NULL）
-  if (strlen(rpmnew_path) < sizeof(merged_path) - 8) {
+static zy_child *zy_find(pid_t pid)
+{
+  for (int i = 0; i < ZY_MAX_CHILDREN; i++) {
+    if (g_zy_children[i].pid == pid) return &g_zy_children[i];
+  }
+  return NULL;
+}
 
-    snprintf(merged_path, sizeof(merged_path), "%s.merged", rpmnew_path);
+static int zy_is_priv(pid_t pid)
+{
+  zy_child *c = pid > 0 ? zy_find(pid) : NULL;
+  return c && c->ch->priv;
+}
 
-    if (rename(rpmnew_path, merged_path) == 0) {
-      printf("trade: merge: renamed %s -> %s\n", rpmnew_path, merged_path);
-    } else {
-      fprintf(stderr, "trade: merge: rename failed: %s (%s)\n",
-              rpmnew_path, strerror(errno));
+static void zy_lost(zy_chan *ch)
+{
+  fprintf(stderr, "trade: %s exited; %s\n", ch->priv ? "privileged helper" : "zygote",
+          ch->priv ? "back to sudo per command" : "spawning locally");
+  close(ch->fd);
+  ch->fd = -1;
+  waitpid(ch->pid, NULL, 0);
+  ch->pid = -1;
+  // children we can no longer hear about count as failed
+  for (int i = 0; i < ZY_MAX_CHILDREN; i++) {
+    if (g_zy_children[i].pid > 0 && g_zy_children[i].ch == ch && !g_zy_children[i].done) {
+      g_zy_children[i].done = 1;
+      g_zy_children[i].status = 1 << 8;
     }
-
-  } else {
-    fprintf(stderr, "trade: merge: path too long, skip rename: %s\n", rpmnew_path);
   }
 }
 
-  return 0;
+// Read one message from the zygote; ZY_EXIT and ZY_STOP are also
+// recorded in the child table. 0 on EOF.
+static int zy_read(zy_chan *ch, zy_msg *m)
+{
+  ssize_t n = zy_recv(ch->fd, m, NULL, 0, NULL, NULL);
+  if (n <= 0) { zy_lost(ch); return 0; }
+  if (m->type == ZY_EXIT) {
+    zy_child *c = zy_find(m->pid);
+    if (c) { c->done = 1; c->stopped = 0; c->status = m->status; c->ru = m->ru; }
+    g_child_event = 1;
+  } else if (m->type == ZY_STOP) {
+    zy_child *c = zy_find(m->pid);
+    if (c) c->stopped = WIFSTOPPED(m->status) ? WSTOPSIG(m->status) : 0;
+    g_child_event = 1;
+  }
+  return 1;
 }
 
-static int merge_rpmnew_in_dir(const char *dirpath)
+// Returns pid, -1 after printing an exec error, or -2 if the request
+// cannot go through `ch` (caller spawns locally). `pgid` as in zy_msg.
+static pid_t zygote_spawn(zy_chan *ch, const char *path, char *const argv[], int fd_in, int fd_out,
+                          int fd_err, pid_t pgid)
 {
-  DIR *dir = opendir(dirpath);
-  if (!dir) {
-    fprintf(stderr, "trade: merge: cannot open dir: %s (%s)\n",
-            dirpath, strerror(errno));
-    return 1;
+  zy_child *slot = zy_find(0);
+  if (ch->fd < 0 || !slot) return -2;
+
+  static char payload[ZY_MAX_PAYLOAD];
+  size_t off = 0;
+  uint32_t argc = 0;
+  const char *first = path ? path : argv[0];
+  size_t l = strlen(first) + 1;
+  if (l > sizeof(payload)) return -2;
+  memcpy(payload, first, l);
+  off = l;
+  for (; argv[argc]; argc++) {
+    l = strlen(argv[argc]) + 1;
+    if (off + l > sizeof(payload) || argc >= 1023) return -2;
+    memcpy(payload + off, argv[argc], l);
+    off += l;
   }
 
-  struct dirent *ent;
-  int processed = 0;
+  int cwd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (cwd < 0) return -2;
+  int fds[ZY_NFDS] = {
+    cwd,
+    fd_in >= 0 ? fd_in : STDIN_FILENO,
+    fd_out >= 0 ? fd_out : STDOUT_FILENO,
+    fd_err >= 0 ? fd_err : STDERR_FILENO,
+  };
+  zy_msg m = { .type = ZY_SPAWN, .argc = argc, .len = (uint32_t)off, .pgid = pgid };
+  ssize_t n = zy_send(ch->fd, &m, payload, fds, ZY_NFDS);
+  close(cwd);
+  if (n < 0) { zy_lost(ch); return -2; }
+
+  zy_msg rep;
+  do {
+    if (!zy_read(ch, &rep)) return -2;
+  } while (rep.type != ZY_SPAWNED);
+  if (rep.pid < 0 || rep.err != 0) {
+    fprintf(stderr, "trade: exec failed: %s (%s)\n", argv[0], strerror(rep.err));
+    if (rep.pid > 0) {
+      // the child already exited with 127; keep it so its exit is consumed
+      slot->pid = rep.pid; slot->ch = ch; slot->done = 0;
+      while (!slot->done && ch->fd >= 0) {
+        zy_msg x;
+        if (!zy_read(ch, &x)) break;
+      }
+      slot->pid = 0;
+    }
+    return -1;
+  }
+  slot->pid = rep.pid;
+  slot->ch = ch;
+  slot->done = 0;
+  slot->stopped = 0;
+  return rep.pid;
+}
+
+// Wait for a zygote child. Returns 1 and fills *status and *ru if `pid`
+// is one.
+static int zygote_wait(pid_t pid, int *status, struct rusage *ru)
+{
+  zy_child *c = zy_find(pid);
+  if (!c || pid <= 0) return 0;
+  while (!c->done && c->ch->fd >= 0) {
+    zy_msg m;
+    if (!zy_read(c->ch, &m)) break;
+  }
+  *status = c->done ? c->status : (1 << 8);
+  *ru = c->ru;
+  c->pid = 0;
+  return 1;
+}
+
+static long mono_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// ====== privileged helper ======
+// With `set privhelper on` (or TRADE_PRIV_HELPER=1), the first sudo
+// command on the allowlist below starts `sudo -n tradeshell --priv-helper`
+// once; from then on those commands are spawned by that root process
+// over the zygote protocol instead of through a fresh sudo each time
+// (PAM, sudoers parsing and logging cost 20-100 ms per call). sudoers
+// must allow the tradeshell binary itself; if it does not, commands
+// keep using sudo. The helper connects back to an abstract socket named
+// on its command line, as sudo closes inherited fds; each side checks
+// the other's uid. Each of its children leads a session of its own: it
+// never owns the terminal, Ctrl-C reaches it through ZY_KILL and it
+// cannot be stopped with Ctrl-Z.
+#define PRIV_START_MS 5000
+
+static int g_priv_tried = 0;
+
+// The helper checks every argv against these entries itself. The service
+// verbs must match their template exactly; install takes exactly one
+// argument, the rpm path that build_install_argv() makes (checked by
+// priv_install_ok()). scat and the log/config/backup/restore/update tools
+// take any arguments after their template, so the helper reads any file
+// as root and runs those tools as root with whatever the user passes:
+// the same as their sudo rules, but once sudoers allows
+// `tradeshell --priv-helper` it grants all of that without a password.
+// This is why privhelper is off unless asked for.
+static const cmd_id g_priv_ops[] = {
+  CMD_START, CMD_STOP, CMD_RESTART, CMD_STATUS, CMD_LOG, CMD_CONFIG,
+  CMD_BACKUP, CMD_RESTORE, CMD_SCAT, CMD_UPDATE, CMD_INSTALL,
+};
+
+#define PRIV_WARNING \
+  "trade: privhelper: the root helper runs scat on any file and log, config, backup,\n" \
+  "  restore and update with any arguments, without asking for a password\n"
+
+// "<home>/fx_autotrade-system-<version>-2.el9.x86_64.rpm", with home from
+// the passwd entry of `uid` (never the client's HOME) and a version of
+// letters, digits, '.', '_' and '-' only.
+static int priv_install_ok(const char *path, uid_t uid)
+{
+  static const char pre[] = "/fx_autotrade-system-", suf[] = "-2.el9.x86_64.rpm";
+  struct passwd *pw = getpwuid(uid);
+  if (!pw || !pw->pw_dir || pw->pw_dir[0] != '/') return 0;
+  size_t hl = strlen(pw->pw_dir);
+  if (strncmp(path, pw->pw_dir, hl) != 0 || strncmp(path + hl, pre, sizeof(pre) - 1) != 0) return 0;
+
+  const char *ver = path + hl + sizeof(pre) - 1;
+  size_t vl = strlen(ver);
+  if (vl <= sizeof(suf) - 1 || strcmp(ver + vl - (sizeof(suf) - 1), suf) != 0) return 0;
+  for (size_t i = 0; i < vl - (sizeof(suf) - 1); i++) {
+    if (!isalnum((unsigned char)ver[i]) && !strchr("._-", ver[i])) return 0;
+  }
+  return 1;
+}
+
+// The g_priv_ops entry that allows `argv` (run for `uid`), or -1.
+static int priv_allowed(char *const argv[], uid_t uid)
+{
+  for (size_t i = 0; i < sizeof(g_priv_ops) / sizeof(g_priv_ops[0]); i++) {
+    const cmd_entry *e = &cmd_table[g_priv_ops[i]];
+    int k = 0;
+    while (e->prefix[k] && argv[k] && strcmp(e->prefix[k], argv[k]) == 0) k++;
+    if (e->prefix[k]) continue;
+    if (e->kind == CMD_PARENT_BUILTIN && argv[k]) continue;
+    if (g_priv_ops[i] == CMD_INSTALL &&
+        (!argv[k] || argv[k + 1] || !priv_install_ok(argv[k], uid))) continue;
+    return (int)g_priv_ops[i];
+  }
+  return -1;
+}
+
+// The helper runs everything from /, so scat's relative file names are
+// made absolute against the shell's cwd before they are sent. NULL when
+// the cwd is unknown.
+static char **priv_abs_args(char *const argv[])
+{
+  char cwd[PATH_MAX];
+  if (!getcwd(cwd, sizeof(cwd))) return NULL;
+  int n = 0;
+  while (argv[n]) n++;
+  char **out = arena_alloc(&g_arena, (size_t)(n + 1) * sizeof(char *));
+  if (!out) return NULL;
+  for (int i = 0; i < n; i++) {
+    out[i] = argv[i];
+    if (i < 1 || argv[i][0] == '/' || argv[i][0] == '-') continue;
+    size_t l = strlen(cwd) + strlen(argv[i]) + 2;
+    if (!(out[i] = arena_alloc(&g_arena, l))) return NULL;
+    snprintf(out[i], l, "%s/%s", cwd, argv[i]);
+  }
+  out[n] = NULL;
+  return out;
+}
+
+// kill(), except that the root helper signals its own children.
+static int proc_kill(pid_t pid, int sig)
+{
+  zy_child *c = pid != 0 ? zy_find(pid < 0 ? -pid : pid) : NULL;
+  if (!c || !c->ch->priv) return kill(pid, sig);
+  if (c->ch->fd < 0) { errno = ESRCH; return -1; }
+  zy_msg m = { .type = ZY_KILL, .pid = pid, .status = sig };
+  return zy_send(c->ch->fd, &m, NULL, NULL, 0) < 0 ? -1 : 0;
+}
+
+static socklen_t priv_addr(struct sockaddr_un *sa, const char *name)
+{
+  memset(sa, 0, sizeof(*sa));
+  sa->sun_family = AF_UNIX;
+  size_t n = strlen(name);
+  if (n > sizeof(sa->sun_path) - 2) n = sizeof(sa->sun_path) - 2;
+  memcpy(sa->sun_path + 1, name, n);   // abstract: leading NUL
+  return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + n);
+}
+
+static uid_t peer_uid(int fd)
+{
+  struct ucred cr;
+  socklen_t len = sizeof(cr);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cr, &len) != 0) return (uid_t)-1;
+  return cr.uid;
+}
+
+// Start the helper and wait for it to connect; on any failure commands
+// go on using sudo, and this is not retried.
+static void priv_start(void)
+{
+  g_priv_tried = 1;
+  char exe[PATH_MAX];
+  ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+  if (n <= 0) return;
+  exe[n] = '\0';
+
+  char name[64];
+  snprintf(name, sizeof(name), "tradeshell-priv-%d-%lx", (int)getpid(), (unsigned long)mono_ns());
+  struct sockaddr_un sa;
+  socklen_t salen = priv_addr(&sa, name);
+  int lfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (lfd < 0) return;
+  if (bind(lfd, (struct sockaddr *)&sa, salen) != 0 || listen(lfd, 4) != 0) {
+    close(lfd);
+    return;
+  }
+
+  // its own group, so Ctrl-C at the prompt does not reach sudo
+  char *const argv[] = { (char *)SUDO, "-n", exe, "--priv-helper", name, NULL };
+  posix_spawn_file_actions_t fa;
+  posix_spawn_file_actions_init(&fa);
+  for (int fd = 0; fd < 3; fd++)
+    posix_spawn_file_actions_addopen(&fa, fd, "/dev/null", fd ? O_WRONLY : O_RDONLY, 0);
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setpgroup(&attr, 0);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+  pid_t pid;
+  int err = posix_spawnp(&pid, SUDO, &fa, &attr, argv, environ);
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&fa);
+  if (err != 0) { close(lfd); return; }
+
+  int fd = -1, status;
+  long deadline = mono_ns() + PRIV_START_MS * 1000000L;
+  while (fd < 0 && mono_ns() < deadline) {
+    struct pollfd pf = { .fd = lfd, .events = POLLIN };
+    if (poll(&pf, 1, 100) > 0) {
+      fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+      if (fd >= 0 && peer_uid(fd) != 0) { close(fd); fd = -1; }   // not the helper
+    }
+    if (fd < 0 && waitpid(pid, &status, WNOHANG) == pid) { pid = -1; break; }
+  }
+  close(lfd);
+  if (fd < 0) {
+    fprintf(stderr, "trade: privileged helper did not start; using sudo per command\n");
+    if (pid > 0) { kill(pid, SIGTERM); waitpid(pid, NULL, 0); }
+    return;
+  }
+  g_priv.fd = fd;
+  g_priv.pid = pid;
+}
+
+// `tradeshell --priv-helper NAME`, run by sudo.
+__attribute__((noreturn))
+static void priv_helper_main(const char *name)
+{
+  const char *uid = getenv("SUDO_UID");
+  if (geteuid() != 0 || !uid) {
+    fprintf(stderr, "trade: --priv-helper must be started through sudo\n");
+    _exit(1);
+  }
+  struct sockaddr_un sa;
+  socklen_t salen = priv_addr(&sa, name);
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&sa, salen) != 0) _exit(1);
+  // only the user sudo ran us for may drive us
+  g_priv_uid = (uid_t)strtoul(uid, NULL, 10);
+  if (peer_uid(fd) != g_priv_uid) _exit(1);
+  zygote_main(fd, 1);
+}
+
+// ====== trace ======
+// `trace on` records where each line's time goes into a fixed ring of
+// complete events (start + duration, CLOCK_MONOTONIC): read_line,
+// tokenize, dispatch, builtin bodies, spawn and wait on the shell's own
+// track, and one exec event per child on a track of its own (tid = its
+// pid, or the native thread's tid). `trace dump FILE` writes the ring as
+// Chrome trace JSON for chrome://tracing or ui.perfetto.dev.
+//
+// Only the main thread records. While tracing is off, trace_now()
+// returns 0 and trace_add() returns at once.
+#define TRACE_EVENTS 4096
+
+typedef struct {
+  const char *phase;     // static string
+  long ts_ns, dur_ns;
+  int tid;               // 0 = the shell's main thread
+  char detail[64];       // command, truncated
+} trace_ev;
+
+static trace_ev *g_trace;            // allocated on first `trace on`
+static unsigned long g_trace_n;      // events recorded since `trace on`
+static int g_trace_on;
+static long g_trace_dispatch_ns;     // line tokenized, not dispatched yet
+
+static long trace_now(void) { return g_trace_on ? mono_ns() : 0; }
+
+static void trace_add(const char *phase, long t0, long t1, int tid, const char *detail)
+{
+  if (!g_trace_on || !t0) return;
+  trace_ev *ev = &g_trace[g_trace_n++ % TRACE_EVENTS];
+  ev->phase = phase;
+  ev->ts_ns = t0;
+  ev->dur_ns = t1 - t0;
+  ev->tid = tid;
+  snprintf(ev->detail, sizeof(ev->detail), "%s", detail ? detail : "");
+}
+
+// Space-separated words of v (up to n, or the NULL), truncated to fit.
+static void join_words(char *d, size_t cap, char *const v[], int n)
+{
+  size_t len = 0;
+  d[0] = '\0';
+  for (int i = 0; (n < 0 ? v[i] != NULL : i < n) && len < cap - 1; i++) {
+    int k = snprintf(d + len, cap - len, "%s%s", i ? " " : "", v[i]);
+    if (k < 0) break;
+    len += (size_t)k;
+  }
+}
+
+// Same, with the detail built from an argv.
+static void trace_add_argv(const char *phase, long t0, long t1, int tid, char *const argv[])
+{
+  if (!g_trace_on || !t0) return;
+  char d[64];
+  join_words(d, sizeof(d), argv, -1);
+  trace_add(phase, t0, t1, tid, d);
+}
+
+// Closes the dispatch phase opened when the line was tokenized.
+static void trace_dispatched(void)
+{
+  trace_add("dispatch", g_trace_dispatch_ns, trace_now(), 0, NULL);
+  g_trace_dispatch_ns = 0;
+}
+
+static void json_str(FILE *f, const char *s)
+{
+  fputc('"', f);
+  for (; *s; s++) {
+    unsigned char c = (unsigned char)*s;
+    if (c == '"' || c == '\\') fprintf(f, "\\%c", c);
+    else if (c < 0x20) fprintf(f, "\\u%04x", c);
+    else fputc(c, f);
+  }
+  fputc('"', f);
+}
+
+// Returns the number of events written, -1 on error (errno set).
+static long trace_dump(const char *path)
+{
+  FILE *f = fopen(path, "we");
+  if (!f) return -1;
+
+  int pid = (int)getpid();
+  unsigned long n = g_trace_n < TRACE_EVENTS ? g_trace_n : TRACE_EVENTS;
+  unsigned long first = g_trace_n - n;
+  fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"trade\"}}",
+          pid, pid);
+  for (unsigned long i = first; i < g_trace_n; i++) {
+    const trace_ev *ev = &g_trace[i % TRACE_EVENTS];
+    int tid = ev->tid ? ev->tid : pid;
+    fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"trade\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+               "\"ts\":%ld.%03ld,\"dur\":%ld.%03ld",
+            ev->phase, pid, tid, ev->ts_ns / 1000, ev->ts_ns % 1000,
+            ev->dur_ns / 1000, ev->dur_ns % 1000);
+    if (ev->detail[0]) {
+      fprintf(f, ",\"args\":{\"cmd\":");
+      json_str(f, ev->detail);
+      fputc('}', f);
+    }
+    fputc('}', f);
+    // name child tracks after what ran on them
+    if (ev->tid && ev->detail[0]) {
+      fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", pid, tid);
+      json_str(f, ev->detail);
+      fprintf(f, "}}");
+    }
+  }
+  fprintf(f, "\n]}\n");
+  if (fclose(f) != 0) return -1;
+  return (long)n;
+}
+
+// ====== process spawning ======
+// All children are started through spawn_proc(), which uses posix_spawn
+// (clone(CLONE_VM|CLONE_VFORK) in glibc), so the cost of starting a
+// command does not grow with the shell's own page tables. Pipe wiring is
+// expressed as file actions; fds the shell opens itself are O_CLOEXEC.
+typedef struct {
+  char *const *argv;
+  int fd_in;              // dup2'd onto stdin when >= 0
+  int fd_out;             // dup2'd onto stdout when >= 0
+  int fd_err;             // dup2'd onto stderr when >= 0
+  int setpgrp;            // put the child in process group pgid
+  pid_t pgid;             // 0 = a new group led by the child
+} spawn_req;
+
+// Returns the child's pid, or -1 after printing the reason.
+static pid_t spawn_proc(const spawn_req *r)
+{
+  long t0 = trace_now();
+  const char *path = exe_lookup(r->argv[0]);
+  fflush(stdout);   // our own output goes before the child's
+
+  int op = (g_opt.privhelper && strcmp(r->argv[0], SUDO) == 0)
+    ? priv_allowed(r->argv + 1, getuid()) : -1;
+  char *const *pargv = op == CMD_SCAT ? priv_abs_args(r->argv + 1) : op >= 0 ? r->argv + 1 : NULL;
+  if (pargv) {
+    if (!g_priv_tried) priv_start();
+    pid_t pp = zygote_spawn(&g_priv, NULL, pargv, r->fd_in, r->fd_out, r->fd_err, 0);
+    if (pp != -2) {
+      trace_add_argv("spawn", t0, trace_now(), 0, r->argv);
+      return pp;
+    }
+  }
+
+  if (g_zy.fd >= 0) {
+    pid_t zp = zygote_spawn(&g_zy, path, r->argv, r->fd_in, r->fd_out, r->fd_err,
+                            r->setpgrp ? r->pgid : -1);
+    if (zp != -2) {
+      trace_add_argv("spawn", t0, trace_now(), 0, r->argv);
+      return zp;
+    }
+  }
+
+  posix_spawn_file_actions_t fa;
+  posix_spawn_file_actions_t *fap = NULL;
+  if (r->fd_in >= 0 || r->fd_out >= 0 || r->fd_err >= 0) {
+    posix_spawn_file_actions_init(&fa);
+    if (r->fd_in >= 0)  posix_spawn_file_actions_adddup2(&fa, r->fd_in, STDIN_FILENO);
+    if (r->fd_out >= 0) posix_spawn_file_actions_adddup2(&fa, r->fd_out, STDOUT_FILENO);
+    if (r->fd_err >= 0) posix_spawn_file_actions_adddup2(&fa, r->fd_err, STDERR_FILENO);
+    fap = &fa;
+  }
+
+  // the shell ignores SIGPIPE for its native commands, and the job
+  // control signals; children must not
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  sigset_t def;
+  sigemptyset(&def);
+  sigaddset(&def, SIGPIPE);
+  sigaddset(&def, SIGINT);
+  sigaddset(&def, SIGQUIT);
+  sigaddset(&def, SIGTSTP);
+  sigaddset(&def, SIGTTIN);
+  sigaddset(&def, SIGTTOU);
+  posix_spawnattr_setsigdefault(&attr, &def);
+  short flags = POSIX_SPAWN_SETSIGDEF;
+  if (r->setpgrp) {
+    posix_spawnattr_setpgroup(&attr, r->pgid);
+    flags |= POSIX_SPAWN_SETPGROUP;
+  }
+  posix_spawnattr_setflags(&attr, flags);
+
+  pid_t pid = -1;
+  int err = path
+    ? posix_spawn(&pid, path, fap, &attr, r->argv, environ)
+    : posix_spawnp(&pid, r->argv[0], fap, &attr, r->argv, environ);
+
+  posix_spawnattr_destroy(&attr);
+  if (fap) posix_spawn_file_actions_destroy(fap);
+  trace_add_argv("spawn", t0, trace_now(), 0, r->argv);
+
+  if (err != 0) {
+    fprintf(stderr, "trade: exec failed: %s (%s)\n", r->argv[0], strerror(err));
+    return -1;
+  }
+  return pid;
+}
+
+static int status_to_rc(int status)
+{
+  if (WIFEXITED(status)) return WEXITSTATUS(status);
+  if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+  return 1;
+}
+
+// Resource use as reported by wait4 (or the zygote's wait4), summed
+// over whatever one command line or one stage ran.
+typedef struct {
+  long user_us, sys_us;
+  long maxrss_kb;        // largest single process, not a sum
+  long nvcsw, nivcsw;    // voluntary / involuntary context switches
+  long inblock, oublock;
+} res_use;
+
+static res_use g_line_use;   // everything reaped for the current line
+
+static void res_add(res_use *u, const struct rusage *ru)
+{
+  u->user_us += ru->ru_utime.tv_sec * 1000000L + ru->ru_utime.tv_usec;
+  u->sys_us += ru->ru_stime.tv_sec * 1000000L + ru->ru_stime.tv_usec;
+  if (ru->ru_maxrss > u->maxrss_kb) u->maxrss_kb = ru->ru_maxrss;
+  u->nvcsw += ru->ru_nvcsw;
+  u->nivcsw += ru->ru_nivcsw;
+  u->inblock += ru->ru_inblock;
+  u->oublock += ru->ru_oublock;
+}
+
+// Blocking wait for one child; returns its rc (127 for a failed spawn).
+static int proc_wait(pid_t pid, struct rusage *ru)
+{
+  memset(ru, 0, sizeof(*ru));
+  if (pid <= 0) return 127;
+  int status = 0;
+  if (zygote_wait(pid, &status, ru)) return status_to_rc(status);
+  while (wait4(pid, &status, 0, ru) < 0) {
+    if (errno == EINTR) continue;
+    perror("trade: waitpid");
+    return 1;
+  }
+  return status_to_rc(status);
+}
+
+// pidfd for a child, -1 when the kernel has none (before 5.3).
+static int pidfd_open_pid(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+  return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+  (void)pid;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+static int run_cmd_capture_rc(char *const argv[])
+{
+  spawn_req r = { .argv = argv, .fd_in = -1, .fd_out = -1, .fd_err = -1, .setpgrp = g_jc };
+  pid_t pid = spawn_proc(&r);
+  if (pid < 0) return 127;
+  long t0 = trace_now();
+  int rc = proc_wait_timed(pid, argv);
+  long t1 = trace_now();
+  trace_add("wait", t0, t1, 0, NULL);
+  trace_add_argv("exec", t0, t1, pid, argv);
+  return rc;
+}
+
+static void detect_sudo(void)
+{
+  char *const argv[] = {(char*)SUDO, "-n", "true", NULL};
+  int rc = run_cmd_capture_rc(argv);
+  g_use_sudo = (rc == 0);
+}
+
+static void print_usage(void)
+{
+  puts("AutoTrade Shell (Oracle Linux)");
+  puts("Commands:");
+  puts("  help                  show this help");
+  puts("  exit [N]              quit (with rc N, default: the last rc)");
+  puts("  cd [DIR]              change directory (default: HOME; supports ~ and ~/...)");
+  puts("  pwd                   print current directory");
+  puts("");
+  puts("  start                 [sudo] systemctl start fx-autotrade");
+  puts("  stop                  [sudo] systemctl stop fx-autotrade");
+  puts("  restart               [sudo] systemctl restart fx-autotrade");
+  puts("  restart --wait [MARKER]  stop, start, then wait until the new fx_debug_log.txt");
+  puts("                        has MARKER (or any line); prints stop/start/ready times");
+  puts("  status                service state from its cgroup (or systemd when stopped)");
+  puts("  status --full         [sudo] systemctl status fx-autotrade");
+  puts("  health                service + log + disk + mem + time, probed in parallel");
+  puts("");
+  puts("  log [ARGS...]         python3 /opt/Innovations/System/tools/get_log.py [ARGS...]");
+  puts("  config [ARGS...]      python3 /opt/Innovations/System/tools/xmledit.py [ARGS...]");
+  puts("  backup [ARGS...]      python3 /opt/Innovations/System/tools/Buckup.py [ARGS...]");
+  puts("  restore [ARGS...]     python3 /opt/Innovations/System/tools/Restore.py [ARGS...]");
+  puts("  update [ARGS...]      [sudo] bash /opt/Innovations/System/Update.sh [ARGS...]");
+  puts("  merge-rpmnew         add only new keys from /etc/AutoTrade/*.rpmnew");
+  puts("  arena                 show per-line allocator counters");
+  puts("  hash [-r]             show (or clear) the resolved command path cache");
+  puts("  timeout DURATION CMD  stop CMD (SIGTERM, then SIGKILL) after DURATION");
+  puts("  time CMD              report wall/CPU time, max RSS, switches and I/O of CMD");
+  puts("  stats [-r]            per-command count and p50/p95/max latency (or clear)");
+  puts("  jobs                  list background and stopped jobs");
+  puts("  fg [%N] / bg [%N]     resume a job in the foreground / background");
+  puts("  kill [-SIGNAL] %N     signal a job (default TERM)");
+  puts("  trace [on|off]        record per-phase timings of each line");
+  puts("  trace dump FILE       write them as Chrome/Perfetto trace JSON");
+  puts("  set [NAME [VALUE]]    show or change shell options (pipesize, pipefail,");
+  puts("                        timeout, privtimeout, privhelper, dbus, readytimeout)");
+  puts("");
+  puts("  nano [ARGS...]        nano [ARGS...]");
+  puts("  ls [ARGS...]          ls [ARGS...]");
+  puts("  cat [ARGS...]         cat [ARGS...] (built in unless options/unreadable)");
+  puts("  scat [ARGS...]        sudo cat [ARGS...] (built in if readable without sudo)");
+  puts("  grep [ARGS...]        grep [ARGS...] (built in for -i -v -c -n -F -E)");
+  puts("");
+  puts("Pipes:");
+  puts("  cat file | grep KEYWORD");
+  puts("");
+  puts("Background:");
+  puts("  backup ... &          run as a job; the prompt returns at once");
+  puts("");
+  puts("Lists:");
+  puts("  stop && backup && update ; start");
+  puts("  status || restart");
+  puts("");
+  puts("Quotes:");
+  puts("  cat \"file name.txt\" | grep \"some word\"");
+  puts("");
+  puts("Notes:");
+  puts("  - Only exec-style commands can be used in pipelines.");
+  puts("  - start/stop/restart/status ask systemd over D-Bus; when the bus cannot");
+  puts("    answer (or with `set dbus off`) they run systemctl, with sudo when");
+  puts("    available (sudo -n true).");
+  puts("  - TRADE_ZYGOTE=1 starts commands from a small pre-forked helper.");
+  puts("  - privhelper (or TRADE_PRIV_HELPER=1) starts one root helper with sudo and");
+  puts("    runs service/log/config/backup/restore/scat/update/install through it.");
+  puts("    It reads any file (scat) and runs the python tools and update with any");
+  puts("    arguments as root, so enable it only where sudo already allows that.");
+}
+
+// ====== command accounting ======
+// Every command line is timed and the resource use of what it reaped is
+// summed (g_line_use). The figures are kept per registry entry for
+// `stats`; latency percentiles cover the last STATS_SAMPLES runs.
+#define STATS_SAMPLES 512
+
+typedef struct {
+  unsigned long count;
+  long max_ns;
+  res_use use;
+  long samples[STATS_SAMPLES];   // wall time, ring
+} cmd_stats;
+
+static cmd_stats *g_stats[CMD_NCOMMANDS];   // allocated on first run
+
+static void res_merge(res_use *a, const res_use *b)
+{
+  a->user_us += b->user_us;
+  a->sys_us += b->sys_us;
+  if (b->maxrss_kb > a->maxrss_kb) a->maxrss_kb = b->maxrss_kb;
+  a->nvcsw += b->nvcsw;
+  a->nivcsw += b->nivcsw;
+  a->inblock += b->inblock;
+  a->oublock += b->oublock;
+}
+
+static void stats_record(const cmd_entry *e, long wall_ns, const res_use *u)
+{
+  if (!e || e == &cmd_table[CMD_STATS]) return;   // reading stats is not a run
+  cmd_stats **sp = &g_stats[e - cmd_table];
+  if (!*sp && !(*sp = calloc(1, sizeof(cmd_stats)))) return;
+  cmd_stats *st = *sp;
+  st->samples[st->count % STATS_SAMPLES] = wall_ns;
+  st->count++;
+  if (wall_ns > st->max_ns) st->max_ns = wall_ns;
+  res_merge(&st->use, u);
+}
+
+static const char *fmt_ns(char *buf, size_t n, long ns)
+{
+  if (ns < 1000000L) snprintf(buf, n, "%ldus", ns / 1000);
+  else if (ns < 1000000000L) snprintf(buf, n, "%.1fms", (double)ns / 1e6);
+  else snprintf(buf, n, "%.2fs", (double)ns / 1e9);
+  return buf;
+}
+
+// One `time` line on stderr.
+static void res_print(const char *label, long wall_ns, const res_use *u)
+{
+  fprintf(stderr, "%-10s real %.3fs  user %.3fs  sys %.3fs  maxrss %.1fM  csw %ld/%ld  io %ld/%ld\n",
+          label, (double)wall_ns / 1e9, (double)u->user_us / 1e6, (double)u->sys_us / 1e6,
+          (double)u->maxrss_kb / 1024.0, u->nvcsw, u->nivcsw, u->inblock, u->oublock);
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+  long x = *(const long *)a, y = *(const long *)b;
+  return (x > y) - (x < y);
+}
+
+// ====== systemd over D-Bus ======
+// start/stop/restart/status talk to systemd on the system bus instead of
+// spawning `[sudo] systemctl`. One connection per shell (SASL EXTERNAL,
+// Hello, a match for JobRemoved); a verb is Manager.StartUnit/StopUnit/
+// RestartUnit followed by a wait for the JobRemoved of its job, status
+// is LoadUnit plus Properties.GetAll. DBUS_SYSTEM_BUS_ADDRESS picks the
+// bus, as for systemctl; tests/dbus/run.sh points it at a private bus with
+// a mock manager. Whatever does not end in a job result or a
+// status answer (no bus, access denied, an unexpected reply) returns -1
+// and the builtin runs systemctl as before; after one denial the verbs
+// that change state stop trying. Only little-endian messages are read,
+// which is what peers on x86_64 and aarch64 send.
+#define DBUS_SYSTEMD       "org.freedesktop.systemd1"
+#define DBUS_SYSTEMD_PATH  "/org/freedesktop/systemd1"
+#define DBUS_MANAGER       "org.freedesktop.systemd1.Manager"
+#define DBUS_CONNECT_MS    2000
+#define DBUS_MSG_MAX       (4 << 20)
+#define DBUS_JOBS_SEEN     8
+
+enum { DBUS_CALL = 1, DBUS_RETURN, DBUS_ERROR, DBUS_SIGNAL };
+enum { DF_PATH = 1, DF_INTERFACE, DF_MEMBER, DF_ERROR_NAME, DF_REPLY_SERIAL,
+       DF_DESTINATION, DF_SENDER, DF_SIGNATURE };
+
+typedef struct {
+  int fd;
+  uint32_t serial;
+  int denied;                   // AccessDenied on a state change
+  char *in;                     // received bytes; in[0] starts a message
+  size_t in_len, in_cap, in_used;
+  struct { char job[96]; char result[24]; } seen[DBUS_JOBS_SEEN];
+  unsigned nseen;               // JobRemoved signals, newest last
+} dbus_conn;
+
+static dbus_conn g_bus = { .fd = -1 };
+
+typedef struct {
+  char b[1024];
+  size_t len;
+  int bad;
+} dbus_out;
+
+typedef struct {
+  const char *b;                // aligned like the message it is part of
+  size_t len, pos;
+  int bad;
+} dbus_in;
+
+typedef struct {
+  int type;
+  uint32_t reply_serial;
+  const char *member, *error, *sig;
+  dbus_in body;
+} dbus_msg;
+
+static void dw_raw(dbus_out *w, const void *p, size_t n)
+{
+  if (w->len + n > sizeof(w->b)) { w->bad = 1; return; }
+  memcpy(w->b + w->len, p, n);
+  w->len += n;
+}
+
+static void dw_pad(dbus_out *w, size_t a)
+{
+  static const char zero[8];
+  dw_raw(w, zero, (a - w->len % a) % a);
+}
+
+static void dw_u32(dbus_out *w, uint32_t v) { dw_pad(w, 4); dw_raw(w, &v, 4); }
+
+static void dw_str(dbus_out *w, const char *s)
+{
+  dw_u32(w, (uint32_t)strlen(s));
+  dw_raw(w, s, strlen(s) + 1);
+}
+
+static void dw_sig(dbus_out *w, const char *s)
+{
+  uint8_t n = (uint8_t)strlen(s);
+  dw_raw(w, &n, 1);
+  dw_raw(w, s, n + 1u);
+}
+
+static void dw_field(dbus_out *w, uint8_t code, const char *sig, const char *v)
+{
+  dw_pad(w, 8);
+  dw_raw(w, &code, 1);
+  dw_sig(w, sig);
+  if (sig[0] == 'g') dw_sig(w, v);
+  else dw_str(w, v);
+}
+
+static void dr_pad(dbus_in *r, size_t a)
+{
+  r->pos = (r->pos + a - 1) & ~(a - 1);
+  if (r->pos > r->len) r->bad = 1;
+}
+
+static uint32_t dr_u32(dbus_in *r)
+{
+  uint32_t v = 0;
+  dr_pad(r, 4);
+  if (r->bad || r->pos + 4 > r->len) { r->bad = 1; return 0; }
+  memcpy(&v, r->b + r->pos, 4);
+  r->pos += 4;
+  return v;
+}
+
+static uint64_t dr_u64(dbus_in *r)
+{
+  uint64_t v = 0;
+  dr_pad(r, 8);
+  if (r->bad || r->pos + 8 > r->len) { r->bad = 1; return 0; }
+  memcpy(&v, r->b + r->pos, 8);
+  r->pos += 8;
+  return v;
+}
+
+// s and o; NULL when malformed.
+static const char *dr_str(dbus_in *r)
+{
+  uint32_t n = dr_u32(r);
+  if (r->bad || n >= r->len - r->pos || r->b[r->pos + n] != '\0') { r->bad = 1; return NULL; }
+  const char *s = r->b + r->pos;
+  r->pos += n + 1;
+  return s;
+}
+
+static const char *dr_sig(dbus_in *r)
+{
+  if (r->bad || r->pos >= r->len) { r->bad = 1; return NULL; }
+  size_t n = (uint8_t)r->b[r->pos];
+  if (n >= r->len - r->pos - 1 || r->b[r->pos + 1 + n] != '\0') { r->bad = 1; return NULL; }
+  const char *s = r->b + r->pos + 1;
+  r->pos += n + 2;
+  return s;
+}
+
+static size_t dbus_align(char t)
+{
+  switch (t) {
+  case 'y': case 'g': case 'v': return 1;
+  case 'n': case 'q': return 2;
+  case 'x': case 't': case 'd': case '(': case '{': return 8;
+  default: return 4;
+  }
+}
+
+// Past one complete type in a signature; NULL when malformed.
+static const char *dbus_sig_next(const char *s, int depth)
+{
+  if (!s || depth > 32) return NULL;
+  switch (*s) {
+  case 'a': return dbus_sig_next(s + 1, depth + 1);
+  case '(': case '{': {
+    char close = *s == '(' ? ')' : '}';
+    s++;
+    while (s && *s && *s != close) s = dbus_sig_next(s, depth + 1);
+    return s && *s == close ? s + 1 : NULL;
+  }
+  case '\0': case ')': case '}': return NULL;
+  default: return s + 1;
+  }
+}
+
+// Skip one value of the type at *sig, advancing *sig past it.
+static void dr_skip(dbus_in *r, const char **sig, int depth)
+{
+  const char *t = *sig;
+  const char *next = dbus_sig_next(t, 0);
+  if (!next || depth > 32) { r->bad = 1; return; }
+  *sig = next;
+  switch (*t) {
+  case 'y': r->pos++; break;
+  case 'n': case 'q': dr_pad(r, 2); r->pos += 2; break;
+  case 'x': case 't': case 'd': (void)dr_u64(r); break;
+  case 's': case 'o': (void)dr_str(r); break;
+  case 'g': (void)dr_sig(r); break;
+  case 'v': {
+    const char *vs = dr_sig(r);
+    if (vs) dr_skip(r, &vs, depth + 1);
+    break;
+  }
+  case 'a': {
+    uint32_t n = dr_u32(r);
+    dr_pad(r, dbus_align(t[1]));
+    r->pos += n;
+    break;
+  }
+  case '(': case '{':
+    dr_pad(r, 8);
+    for (t++; !r->bad && t < next - 1; ) dr_skip(r, &t, depth + 1);
+    break;
+  default: (void)dr_u32(r); break;
+  }
+  if (r->pos > r->len) r->bad = 1;
+}
+
+static void dbus_close(dbus_conn *c)
+{
+  if (c->fd >= 0) close(c->fd);
+  c->fd = -1;
+  c->in_len = c->in_used = 0;
+  c->nseen = 0;
+}
+
+// Read until `need` bytes are buffered. 0 on EOF, error, deadline
+// (errno ETIMEDOUT) or Ctrl-C (EINTR).
+static int dbus_fill(dbus_conn *c, size_t need, long deadline)
+{
+  if (need > DBUS_MSG_MAX) { errno = EMSGSIZE; return 0; }
+  if (need > c->in_cap) {
+    size_t cap = c->in_cap ? c->in_cap : 16384;
+    while (cap < need) cap *= 2;
+    char *p = realloc(c->in, cap);
+    if (!p) return 0;
+    c->in = p;
+    c->in_cap = cap;
+  }
+  while (c->in_len < need) {
+    int timeout = -1;
+    if (deadline) {
+      long ms = (deadline - mono_ns()) / 1000000L;
+      if (ms <= 0) { errno = ETIMEDOUT; return 0; }
+      timeout = ms > INT_MAX ? INT_MAX : (int)ms;
+    }
+    struct pollfd pf = { .fd = c->fd, .events = POLLIN };
+    int n = poll(&pf, 1, timeout);
+    if (n < 0 && errno == EINTR) {
+      if (g_interrupted) return 0;
+      continue;
+    }
+    if (n <= 0) { if (n == 0) errno = ETIMEDOUT; return 0; }
+    ssize_t got = read(c->fd, c->in + c->in_len, c->in_cap - c->in_len);
+    if (got < 0 && errno == EINTR) continue;
+    if (got <= 0) { if (got == 0) errno = ECONNRESET; return 0; }
+    c->in_len += (size_t)got;
+  }
+  return 1;
+}
+
+static int dbus_send(dbus_conn *c, const char *path, const char *iface, const char *member,
+                     const char *sig, const dbus_out *body)
+{
+  dbus_out h = { .len = 0 };
+  const uint8_t fixed[4] = { 'l', DBUS_CALL, 0, 1 };
+  dw_raw(&h, fixed, 4);
+  dw_u32(&h, body ? (uint32_t)body->len : 0);
+  dw_u32(&h, ++c->serial);
+  dw_u32(&h, 0);                // header field array length, below
+  size_t start = h.len;
+  dw_field(&h, DF_PATH, "o", path);
+  if (iface) dw_field(&h, DF_INTERFACE, "s", iface);
+  dw_field(&h, DF_MEMBER, "s", member);
+  dw_field(&h, DF_DESTINATION, "s",
+           strcmp(path, "/org/freedesktop/DBus") == 0 ? "org.freedesktop.DBus" : DBUS_SYSTEMD);
+  if (sig) dw_field(&h, DF_SIGNATURE, "g", sig);
+  uint32_t flen = (uint32_t)(h.len - start);
+  memcpy(h.b + 12, &flen, 4);
+  dw_pad(&h, 8);
+  if (h.bad || (body && body->bad)) { errno = EMSGSIZE; return 0; }
+
+  struct iovec iov[2] = {
+    { .iov_base = h.b, .iov_len = h.len },
+    { .iov_base = body ? (void *)body->b : NULL, .iov_len = body ? body->len : 0 },
+  };
+  struct msghdr mh = { .msg_iov = iov, .msg_iovlen = body ? 2 : 1 };
+  ssize_t n;
+  do n = sendmsg(c->fd, &mh, MSG_NOSIGNAL); while (n < 0 && errno == EINTR);
+  return n == (ssize_t)(h.len + (body ? body->len : 0));
+}
+
+// Next message; it stays valid until the next call. A JobRemoved signal
+// is also remembered in c->seen.
+static int dbus_recv(dbus_conn *c, dbus_msg *m, long deadline)
+{
+  if (c->in_used) {
+    memmove(c->in, c->in + c->in_used, c->in_len - c->in_used);
+    c->in_len -= c->in_used;
+    c->in_used = 0;
+  }
+  if (!dbus_fill(c, 16, deadline)) return 0;
+  uint32_t body_len, flen;
+  memcpy(&body_len, c->in + 4, 4);
+  memcpy(&flen, c->in + 12, 4);
+  if (c->in[0] != 'l' || flen > DBUS_MSG_MAX || body_len > DBUS_MSG_MAX) { errno = EPROTO; return 0; }
+  size_t hlen = (16 + (size_t)flen + 7) & ~(size_t)7;
+  if (!dbus_fill(c, hlen + body_len, deadline)) return 0;
+  c->in_used = hlen + body_len;
+
+  memset(m, 0, sizeof(*m));
+  m->type = (uint8_t)c->in[1];
+  dbus_in r = { .b = c->in, .len = 16 + flen, .pos = 16 };
+  while (!r.bad && r.pos < r.len) {
+    dr_pad(&r, 8);
+    if (r.pos >= r.len) break;
+    uint8_t code = (uint8_t)r.b[r.pos++];
+    const char *vs = dr_sig(&r);
+    if (!vs) break;
+    if (code == DF_REPLY_SERIAL && strcmp(vs, "u") == 0) m->reply_serial = dr_u32(&r);
+    else if (code == DF_MEMBER && strcmp(vs, "s") == 0) m->member = dr_str(&r);
+    else if (code == DF_ERROR_NAME && strcmp(vs, "s") == 0) m->error = dr_str(&r);
+    else if (code == DF_SIGNATURE && strcmp(vs, "g") == 0) m->sig = dr_sig(&r);
+    else dr_skip(&r, &vs, 0);
+  }
+  if (r.bad) { errno = EPROTO; return 0; }
+  m->body = (dbus_in){ .b = c->in + hlen, .len = body_len };
+
+  // JobRemoved(u id, o job, s unit, s result)
+  if (m->type == DBUS_SIGNAL && m->member && strcmp(m->member, "JobRemoved") == 0 &&
+      m->sig && strcmp(m->sig, "uoss") == 0) {
+    dbus_in b = m->body;
+    (void)dr_u32(&b);
+    const char *job = dr_str(&b);
+    (void)dr_str(&b);
+    const char *result = dr_str(&b);
+    if (job && result) {
+      unsigned k = c->nseen++ % DBUS_JOBS_SEEN;
+      snprintf(c->seen[k].job, sizeof(c->seen[k].job), "%s", job);
+      snprintf(c->seen[k].result, sizeof(c->seen[k].result), "%s", result);
+    }
+  }
+  return 1;
+}
+
+// Send a call and wait for its reply (return or error), remembering any
+// JobRemoved seen on the way. 0 on I/O failure (connection closed).
+static int dbus_call(dbus_conn *c, const char *path, const char *iface, const char *member,
+                     const char *sig, const dbus_out *body, dbus_msg *reply, long deadline)
+{
+  if (!dbus_send(c, path, iface, member, sig, body)) { dbus_close(c); return 0; }
+  uint32_t serial = c->serial;
+  for (;;) {
+    if (!dbus_recv(c, reply, deadline)) {
+      if (errno != EINTR && errno != ETIMEDOUT) dbus_close(c);
+      return 0;
+    }
+    if ((reply->type == DBUS_RETURN || reply->type == DBUS_ERROR) && reply->reply_serial == serial)
+      return 1;
+  }
+}
+
+// First unix:path= or unix:abstract= entry of the bus address list.
+static socklen_t dbus_addr(struct sockaddr_un *sa)
+{
+  const char *a = getenv("DBUS_SYSTEM_BUS_ADDRESS");
+  if (!a || !*a) a = "unix:path=/run/dbus/system_bus_socket";
+  memset(sa, 0, sizeof(*sa));
+  sa->sun_family = AF_UNIX;
+
+  while (*a) {
+    size_t elen = strcspn(a, ";");
+    if (strncmp(a, "unix:", 5) == 0) {
+      const char *p = a + 5, *end = a + elen;
+      while (p < end) {
+        size_t klen = strcspn(p, ",;");
+        if (p + klen > end) klen = (size_t)(end - p);
+        int abstract = strncmp(p, "abstract=", 9) == 0;
+        if (abstract || strncmp(p, "path=", 5) == 0) {
+          const char *v = p + (abstract ? 9 : 5), *vend = p + klen;
+          size_t o = abstract ? 1 : 0;
+          while (v < vend && o < sizeof(sa->sun_path) - 1) {
+            unsigned x;
+            if (*v == '%' && vend - v >= 3 && sscanf(v + 1, "%2x", &x) == 1) {
+              sa->sun_path[o++] = (char)x;
+              v += 3;
+            } else {
+              sa->sun_path[o++] = *v++;
+            }
+          }
+          return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + o + !abstract);
+        }
+        p += klen + 1;
+      }
+    }
+    a += elen + (a[elen] == ';');
+  }
+  return 0;
+}
+
+// Connected and authenticated g_bus, or NULL.
+static dbus_conn *dbus_open(void)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  dbus_conn *c = &g_bus;
+  if (c->fd >= 0) return c;
+
+  struct sockaddr_un sa;
+  socklen_t salen = dbus_addr(&sa);
+  if (!salen) return NULL;
+  c->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (c->fd < 0) return NULL;
+  if (connect(c->fd, (struct sockaddr *)&sa, salen) != 0) { dbus_close(c); return NULL; }
+
+  // SASL EXTERNAL: the uid in hex-encoded ASCII digits
+  char uid[16], auth[64];
+  int n = snprintf(uid, sizeof(uid), "%u", (unsigned)geteuid());
+  int k = snprintf(auth, sizeof(auth), "%cAUTH EXTERNAL ", '\0');
+  for (int i = 0; i < n; i++) k += snprintf(auth + k, sizeof(auth) - (size_t)k, "%02x", uid[i]);
+  k += snprintf(auth + k, sizeof(auth) - (size_t)k, "\r\n");
+  long deadline = mono_ns() + DBUS_CONNECT_MS * 1000000L;
+  if (write(c->fd, auth, (size_t)k) != k) { dbus_close(c); return NULL; }
+  char *crlf = NULL;
+  while (!crlf) {
+    if (!dbus_fill(c, c->in_len + 1, deadline)) { dbus_close(c); return NULL; }
+    crlf = memmem(c->in, c->in_len, "\r\n", 2);
+  }
+  if (c->in_len < 3 || strncmp(c->in, "OK ", 3) != 0) { dbus_close(c); return NULL; }
+  c->in_used = (size_t)(crlf + 2 - c->in);
+  if (write(c->fd, "BEGIN\r\n", 7) != 7) { dbus_close(c); return NULL; }
+
+  dbus_msg m;
+  dbus_out match = { .len = 0 };
+  dw_str(&match, "type='signal',sender='" DBUS_SYSTEMD "',interface='" DBUS_MANAGER "',"
+                 "member='JobRemoved',path='" DBUS_SYSTEMD_PATH "'");
+  if (!dbus_call(c, "/org/freedesktop/DBus", "org.freedesktop.DBus", "Hello", NULL, NULL, &m, deadline) ||
+      m.type != DBUS_RETURN ||
+      !dbus_call(c, "/org/freedesktop/DBus", "org.freedesktop.DBus", "AddMatch", "s", &match, &m, deadline) ||
+      m.type != DBUS_RETURN) {
+    dbus_close(c);
+    return NULL;
+  }
+  return c;
+#else
+  return NULL;
+#endif
+}
+
+static int dbus_is_denied(const dbus_msg *m)
+{
+  return m->error && (strcmp(m->error, "org.freedesktop.DBus.Error.AccessDenied") == 0 ||
+                      strcmp(m->error, "org.freedesktop.DBus.Error.InteractiveAuthorizationRequired") == 0);
+}
+
+// How long a verb may wait for its job: as for `sudo systemctl`, the
+// `timeout` prefix, `set timeout` and `set privtimeout`; 0 = no limit.
+static long dbus_deadline(void)
+{
+  long d = g_cmd_deadline_ns;
+  long ms = g_opt.timeout_ms;
+  if (g_opt.privtimeout_ms && (!ms || g_opt.privtimeout_ms < ms)) ms = g_opt.privtimeout_ms;
+  if (ms) {
+    long t = mono_ns() + ms * 1000000L;
+    if (!d || t < d) d = t;
+  }
+  return d;
+}
+
+// StartUnit/StopUnit/RestartUnit and wait for the job to finish. The rc
+// systemctl would give, or -1 to run systemctl instead.
+static int dbus_unit_job(const char *method, const char *verb)
+{
+  if (!g_opt.dbus || g_bus.denied) return -1;
+  long t0 = trace_now(), start = mono_ns();
+  dbus_conn *c = dbus_open();
+  if (!c) return -1;
+
+  char unit[64];
+  snprintf(unit, sizeof(unit), "%s.service", SERVICE_NAME);
+  dbus_out body = { .len = 0 };
+  dw_str(&body, unit);
+  dw_str(&body, "replace");
+
+  long deadline = dbus_deadline();
+  dbus_msg m;
+  int rc = -1;
+  char job[96] = "";
+  c->nseen = 0;
+  if (!dbus_call(c, DBUS_SYSTEMD_PATH, DBUS_MANAGER, method, "ss", &body, &m, deadline)) {
+    if (errno == EINTR) rc = 128 + SIGINT;
+    else if (errno == ETIMEDOUT) rc = 124;
+  } else if (m.type == DBUS_ERROR) {
+    if (dbus_is_denied(&m)) c->denied = 1;
+  } else {
+    const char *p = m.sig && strcmp(m.sig, "o") == 0 ? dr_str(&m.body) : NULL;
+    if (p) snprintf(job, sizeof(job), "%s", p);
+  }
+
+  // the signal may have come in before the reply
+  while (job[0] && rc < 0) {
+    for (unsigned i = 0; i < c->nseen && i < DBUS_JOBS_SEEN; i++) {
+      if (strcmp(c->seen[i].job, job) != 0) continue;
+      const char *res = c->seen[i].result;
+      rc = strcmp(res, "done") == 0 ? 0 : 1;
+      if (rc) fprintf(stderr, "trade: %s: job for %s %s\n", verb, unit,
+                      strcmp(res, "failed") == 0 ? "failed" : res);
+    }
+    if (rc >= 0) break;
+    if (!dbus_recv(c, &m, deadline)) {
+      if (errno == EINTR) rc = 128 + SIGINT;
+      else if (errno == ETIMEDOUT) rc = 124;
+      else { dbus_close(c); break; }   // bus gone mid-job: let systemctl report
+    }
+  }
+  if (rc == 124)
+    fprintf(stderr, "trade: %s timed out after %.1fs (job still queued in systemd)\n", verb,
+            (double)(mono_ns() - start) / 1e9);
+  trace_add("dbus", t0, trace_now(), 0, method);
+  return rc;
+}
+
+typedef struct {
+  char id[64], desc[128], load[24], active[24], sub[24], path[160], result[24];
+  uint64_t active_enter_us, mem, cpu_ns, tasks;
+  uint32_t main_pid, restarts;
+} unit_status;
+
+// Properties.GetAll(iface) into *st; 0 on failure.
+static int dbus_get_all(dbus_conn *c, const char *path, const char *iface, unit_status *st, long deadline)
+{
+  dbus_out body = { .len = 0 };
+  dw_str(&body, iface);
+  dbus_msg m;
+  if (!dbus_call(c, path, "org.freedesktop.DBus.Properties", "GetAll", "s", &body, &m, deadline) ||
+      m.type != DBUS_RETURN || !m.sig || strcmp(m.sig, "a{sv}") != 0)
+    return 0;
+
+  dbus_in *r = &m.body;
+  uint32_t n = dr_u32(r);
+  dr_pad(r, 8);
+  size_t end = r->pos + n;
+  if (end > r->len) return 0;
+  static const struct { const char *name; size_t off, size; } strs[] = {
+    { "Id",          offsetof(unit_status, id),     sizeof(((unit_status *)0)->id) },
+    { "Description", offsetof(unit_status, desc),   sizeof(((unit_status *)0)->desc) },
+    { "LoadState",   offsetof(unit_status, load),   sizeof(((unit_status *)0)->load) },
+    { "ActiveState", offsetof(unit_status, active), sizeof(((unit_status *)0)->active) },
+    { "SubState",    offsetof(unit_status, sub),    sizeof(((unit_status *)0)->sub) },
+    { "FragmentPath", offsetof(unit_status, path),  sizeof(((unit_status *)0)->path) },
+    { "Result",      offsetof(unit_status, result), sizeof(((unit_status *)0)->result) },
+  };
+  while (!r->bad && r->pos < end) {
+    dr_pad(r, 8);
+    const char *key = dr_str(r);
+    const char *vs = dr_sig(r);
+    if (!key || !vs) break;
+    if (strcmp(vs, "s") == 0) {
+      const char *v = dr_str(r);
+      for (size_t i = 0; v && i < sizeof(strs) / sizeof(strs[0]); i++) {
+        if (strcmp(key, strs[i].name) == 0) snprintf((char *)st + strs[i].off, strs[i].size, "%s", v);
+      }
+    } else if (strcmp(vs, "t") == 0) {
+      uint64_t v = dr_u64(r);
+      if (strcmp(key, "ActiveEnterTimestamp") == 0) st->active_enter_us = v;
+      else if (strcmp(key, "MemoryCurrent") == 0) st->mem = v;
+      else if (strcmp(key, "CPUUsageNSec") == 0) st->cpu_ns = v;
+      else if (strcmp(key, "TasksCurrent") == 0) st->tasks = v;
+    } else if (strcmp(vs, "u") == 0) {
+      uint32_t v = dr_u32(r);
+      if (strcmp(key, "MainPID") == 0) st->main_pid = v;
+      else if (strcmp(key, "NRestarts") == 0) st->restarts = v;
+    } else {
+      dr_skip(r, &vs, 0);
+    }
+  }
+  return !r->bad;
+}
+
+// 1536 -> "1.5K", as systemctl prints sizes
+static const char *fmt_size(char *buf, size_t n, uint64_t v)
+{
+  static const char units[] = "BKMGTP";
+  double d = (double)v;
+  int u = 0;
+  while (d >= 1024.0 && u < 5) { d /= 1024.0; u++; }
+  if (u == 0) snprintf(buf, n, "%lluB", (unsigned long long)v);
+  else snprintf(buf, n, "%.1f%c", d, units[u]);
+  return buf;
+}
+
+// "3h 2min", "2min 5s", "45s"
+static const char *fmt_span(char *buf, size_t n, long sec)
+{
+  if (sec >= 86400) snprintf(buf, n, "%ld day%s %ldh", sec / 86400, sec >= 2 * 86400 ? "s" : "", sec % 86400 / 3600);
+  else if (sec >= 3600) snprintf(buf, n, "%ldh %ldmin", sec / 3600, sec % 3600 / 60);
+  else if (sec >= 60) snprintf(buf, n, "%ldmin %lds", sec / 60, sec % 60);
+  else snprintf(buf, n, "%lds", sec);
+  return buf;
+}
+
+// The header of `systemctl status` from unit properties. The rc
+// systemctl would give (0 active, 3 not active, 4 no such unit), or -1
+// to run systemctl instead.
+static int dbus_unit_status(void)
+{
+  if (!g_opt.dbus) return -1;
+  long t0 = trace_now();
+  dbus_conn *c = dbus_open();
+  if (!c) return -1;
+
+  char unit[64];
+  snprintf(unit, sizeof(unit), "%s.service", SERVICE_NAME);
+  dbus_out body = { .len = 0 };
+  dw_str(&body, unit);
+  long deadline = mono_ns() + DBUS_CONNECT_MS * 1000000L;
+  if (g_cmd_deadline_ns && g_cmd_deadline_ns < deadline) deadline = g_cmd_deadline_ns;
+  dbus_msg m;
+  char path[160];
+  if (!dbus_call(c, DBUS_SYSTEMD_PATH, DBUS_MANAGER, "LoadUnit", "s", &body, &m, deadline) ||
+      m.type != DBUS_RETURN || !m.sig || strcmp(m.sig, "o") != 0)
+    return -1;
+  const char *p = dr_str(&m.body);
+  if (!p) return -1;
+  snprintf(path, sizeof(path), "%s", p);
+
+  unit_status st;
+  memset(&st, 0, sizeof(st));
+  st.mem = st.tasks = UINT64_MAX;
+  if (!dbus_get_all(c, path, "org.freedesktop.systemd1.Unit", &st, deadline) ||
+      !dbus_get_all(c, path, "org.freedesktop.systemd1.Service", &st, deadline))
+    return -1;
+  trace_add("dbus", t0, trace_now(), 0, "status");
+
+  if (strcmp(st.load, "not-found") == 0) {
+    fprintf(stderr, "Unit %s could not be found.\n", unit);
+    return 4;
+  }
+  int failed = strcmp(st.active, "failed") == 0;
+  printf("%s %s - %s\n", failed ? "×" : "●", st.id[0] ? st.id : unit, st.desc);
+  printf("     Loaded: %s%s%s%s\n", st.load, st.path[0] ? " (" : "", st.path, st.path[0] ? ")" : "");
+  printf("     Active: %s (%s)", st.active, st.sub);
+  if (failed && st.result[0]) printf(" (Result: %s)", st.result);
+  if (st.active_enter_us && strcmp(st.active, "active") == 0) {
+    char when[64], ago[32];
+    time_t t = (time_t)(st.active_enter_us / 1000000u);
+    struct tm tm;
+    localtime_r(&t, &tm);
+    strftime(when, sizeof(when), "%a %Y-%m-%d %H:%M:%S %Z", &tm);
+    printf(" since %s; %s ago", when, fmt_span(ago, sizeof(ago), (long)(time(NULL) - t)));
+  }
+  putchar('\n');
+  char b[32];
+  if (st.main_pid) printf("   Main PID: %u\n", st.main_pid);
+  if (st.tasks != UINT64_MAX) printf("      Tasks: %llu\n", (unsigned long long)st.tasks);
+  if (st.mem != UINT64_MAX) printf("     Memory: %s\n", fmt_size(b, sizeof(b), st.mem));
+  if (st.cpu_ns && st.cpu_ns != UINT64_MAX) printf("        CPU: %s\n", fmt_ns(b, sizeof(b), (long)st.cpu_ns));
+  if (st.restarts) printf("   Restarts: %u\n", st.restarts);
+  fflush(stdout);
+  return strcmp(st.active, "active") == 0 ? 0 : 3;
+}
+
+// ====== status from cgroup v2 ======
+// While the service runs, `status` needs neither systemctl nor the bus:
+// systemd keeps the unit's processes in
+// /sys/fs/cgroup/system.slice/SERVICE_NAME.service, whose files give
+// the tasks, memory, CPU and I/O, and /proc/<pid>/stat gives the main
+// process and its start time. An empty or missing cgroup (stopped,
+// failed, no such unit) or a cgroup v1 host returns -1, and the caller
+// asks systemd instead. TRADE_CGROUP_ROOT replaces /sys/fs/cgroup;
+// tests/cgroup/run.sh points it at a fake tree.
+#define CG_MAX_PIDS 256
+
+// Small file under dfd into buf (NUL-terminated); length or -1.
+static ssize_t read_at(int dfd, const char *name, char *buf, size_t n)
+{
+  int fd = openat(dfd, name, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return -1;
+  ssize_t len = read(fd, buf, n - 1);
+  close(fd);
+  if (len < 0) return -1;
+  buf[len] = '\0';
+  return len;
+}
+
+// "key value" line of a flat-keyed file such as cpu.stat
+static int kv_u64(const char *text, const char *key, uint64_t *out)
+{
+  size_t kl = strlen(key);
+  for (const char *l = text; *l; ) {
+    if (strncmp(l, key, kl) == 0 && l[kl] == ' ') {
+      *out = strtoull(l + kl + 1, NULL, 10);
+      return 1;
+    }
+    const char *nl = strchr(l, '\n');
+    if (!nl) break;
+    l = nl + 1;
+  }
+  return 0;
+}
+
+typedef struct {
+  pid_t pid, ppid;
+  unsigned long long start;     // clock ticks after boot
+  char comm[32];
+} cg_proc;
+
+static int proc_stat(pid_t pid, cg_proc *p)
+{
+  char path[32], buf[1024];
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+  if (read_at(AT_FDCWD, path, buf, sizeof(buf)) <= 0) return 0;
+  // pid (comm) state ppid ... field 22 starttime; comm may hold ") "
+  char *open = strchr(buf, '('), *close = strrchr(buf, ')');
+  if (!open || !close || close < open) return 0;
+  size_t cl = (size_t)(close - open - 1);
+  if (cl >= sizeof(p->comm)) cl = sizeof(p->comm) - 1;
+  memcpy(p->comm, open + 1, cl);
+  p->comm[cl] = '\0';
+  p->pid = pid;
+  char *f = close + 2;
+  int ppid = 0;
+  if (sscanf(f, "%*c %d", &ppid) != 1) return 0;
+  p->ppid = ppid;
+  for (int i = 3; i < 22 && f; i++) {     // field 3 (state) is at f
+    f = strchr(f, ' ');
+    if (f) f++;
+  }
+  if (!f) return 0;
+  p->start = strtoull(f, NULL, 10);
+  return 1;
+}
+
+static int cgroup_status(void)
+{
+  const char *root = getenv("TRADE_CGROUP_ROOT");
+  if (!root || !*root) root = "/sys/fs/cgroup";
+  long t0 = trace_now();
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/cgroup.controllers", root);
+  if (access(path, F_OK) != 0) return -1;          // not cgroup v2
+  snprintf(path, sizeof(path), "%s/system.slice/%s.service", root, SERVICE_NAME);
+  int dfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dfd < 0) return -1;
+
+  char buf[16384];
+  cg_proc procs[CG_MAX_PIDS];
+  int n = 0;
+  if (read_at(dfd, "cgroup.procs", buf, sizeof(buf)) > 0) {
+    for (char *save = NULL, *l = strtok_r(buf, "\n", &save); l && n < CG_MAX_PIDS;
+         l = strtok_r(NULL, "\n", &save)) {
+      if (proc_stat((pid_t)atoi(l), &procs[n])) n++;
+    }
+  }
+  if (n == 0) {
+    close(dfd);
+    return -1;
+  }
+
+  // main: the oldest process whose parent is outside the cgroup
+  cg_proc *main = NULL;
+  for (int i = 0; i < n; i++) {
+    int inside = 0;
+    for (int j = 0; j < n && !inside; j++) inside = procs[j].pid == procs[i].ppid;
+    if (!inside && (!main || procs[i].start < main->start)) main = &procs[i];
+  }
+  if (!main) main = &procs[0];
+
+  uint64_t mem = UINT64_MAX, tasks = UINT64_MAX, usage = 0, user = 0, sys = 0, rd = 0, wr = 0;
+  if (read_at(dfd, "memory.current", buf, sizeof(buf)) > 0) mem = strtoull(buf, NULL, 10);
+  if (read_at(dfd, "pids.current", buf, sizeof(buf)) > 0) tasks = strtoull(buf, NULL, 10);
+  int have_cpu = read_at(dfd, "cpu.stat", buf, sizeof(buf)) > 0 && kv_u64(buf, "usage_usec", &usage);
+  if (have_cpu) {
+    (void)kv_u64(buf, "user_usec", &user);
+    (void)kv_u64(buf, "system_usec", &sys);
+  }
+  // io.stat: "MAJ:MIN rbytes=N wbytes=N rios=N ..." per device
+  int have_io = read_at(dfd, "io.stat", buf, sizeof(buf)) >= 0;
+  for (char *p = buf; have_io && (p = strstr(p, "bytes=")); p += 6) {
+    if (p - buf >= 1 && p[-1] == 'r') rd += strtoull(p + 6, NULL, 10);
+    else if (p - buf >= 1 && p[-1] == 'w') wr += strtoull(p + 6, NULL, 10);
+  }
+  close(dfd);
+
+  struct timespec now;
+  clock_gettime(CLOCK_BOOTTIME, &now);
+  long hz = sysconf(_SC_CLK_TCK);
+  long age = now.tv_sec - (long)(main->start / (unsigned long long)(hz > 0 ? hz : 100));
+  if (age < 0) age = 0;
+  time_t since = time(NULL) - age;
+  struct tm tm;
+  char when[64], ago[32], b[32];
+  localtime_r(&since, &tm);
+  strftime(when, sizeof(when), "%a %Y-%m-%d %H:%M:%S %Z", &tm);
+  trace_add("cgroup", t0, trace_now(), 0, "status");
+
+  printf("● %s.service\n", SERVICE_NAME);
+  printf("     Active: active (running) since %s; %s ago\n", when, fmt_span(ago, sizeof(ago), age));
+  printf("   Main PID: %d (%s)\n", (int)main->pid, main->comm);
+  printf("      Tasks: %llu\n", (unsigned long long)(tasks != UINT64_MAX ? tasks : (uint64_t)n));
+  if (mem != UINT64_MAX)
+    printf("     Memory: %s (%llu bytes)\n", fmt_size(b, sizeof(b), mem), (unsigned long long)mem);
+  if (have_cpu)
+    printf("        CPU: %lluus (user %lluus, system %lluus)\n", (unsigned long long)usage,
+           (unsigned long long)user, (unsigned long long)sys);
+  if (have_io) {
+    char b2[32];
+    printf("         IO: %s read, %s written\n", fmt_size(b, sizeof(b), rd), fmt_size(b2, sizeof(b2), wr));
+  }
+  fflush(stdout);
+  return 0;
+}
+
+// ====== readiness (restart --wait) ======
+// The bot is trading once it has written its startup lines to the
+// fx_debug_log.txt in the temp dir that last_temp.txt names (a new dir
+// per start, normally). ready_begin() runs before the stop: it watches
+// last_temp.txt's dir and the current log dir with inotify, and
+// ready_skip() notes where the current log ends. ready_wait() then
+// follows last_temp.txt to the new dir and reads the log from the start
+// (or, when the dir did not change, from where it ended before the stop)
+// until a line holds the marker; with no marker, any complete line will
+// do. TRADE_LAST_TEMP_FILE replaces last_temp.txt's path.
+#define READY_DIR_EVENTS (IN_CREATE | IN_MODIFY | IN_MOVED_TO)
+
+static const char *last_temp_file(void)
+{
+  const char *f = getenv("TRADE_LAST_TEMP_FILE");
+  return (f && *f) ? f : LAST_TEMP_FILE;
+}
+
+typedef struct {
+  int ifd;                      // inotify
+  int wd_dir;                   // watch on `dir`, -1 = none
+  char dir[PATH_MAX];           // temp dir of the log being read
+  int log_fd;
+  off_t pos;                    // next byte of the log to read
+  char line[4096];              // incomplete last line
+  size_t line_len;
+} ready_watch;
+
+// Last "/tmp/..." line of last_temp.txt into out; 0 when there is none.
+static int last_temp_dir(char *out, size_t n)
+{
+  char buf[4096];
+  int fd = open(last_temp_file(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return 0;
+  ssize_t len = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (len <= 0) return 0;
+  buf[len] = '\0';
+
+  int found = 0;
+  for (char *save = NULL, *l = strtok_r(buf, "\r\n", &save); l; l = strtok_r(NULL, "\r\n", &save)) {
+    while (isspace((unsigned char)*l)) l++;
+    size_t ll = strlen(l);
+    while (ll && isspace((unsigned char)l[ll - 1])) l[--ll] = '\0';
+    if (strncmp(l, "/tmp/", 5) == 0 && ll < n) {
+      memcpy(out, l, ll + 1);
+      found = 1;
+    }
+  }
+  return found;
+}
+
+// Point rw at the log dir last_temp.txt names now, if it changed.
+static void ready_follow(ready_watch *rw)
+{
+  char dir[PATH_MAX];
+  if (!last_temp_dir(dir, sizeof(dir))) return;
+  if (strcmp(dir, rw->dir) == 0) {
+    if (rw->wd_dir < 0) rw->wd_dir = inotify_add_watch(rw->ifd, rw->dir, READY_DIR_EVENTS);
+    return;
+  }
+
+  if (rw->wd_dir >= 0) inotify_rm_watch(rw->ifd, rw->wd_dir);
+  if (rw->log_fd >= 0) close(rw->log_fd);
+  snprintf(rw->dir, sizeof(rw->dir), "%s", dir);
+  rw->wd_dir = inotify_add_watch(rw->ifd, rw->dir, READY_DIR_EVENTS);
+  rw->log_fd = -1;
+  rw->pos = 0;
+  rw->line_len = 0;
+}
+
+static int ready_open_log(ready_watch *rw)
+{
+  if (rw->log_fd < 0) {
+    char path[PATH_MAX + 32];
+    snprintf(path, sizeof(path), "%s/%s", rw->dir, DEBUG_LOG_NAME);
+    rw->log_fd = open(path, O_RDONLY | O_CLOEXEC);
+  }
+  return rw->log_fd >= 0;
+}
+
+// Read what was appended to the log; 1 once a complete line holds
+// marker (any line when marker is NULL).
+static int ready_scan(ready_watch *rw, const char *marker)
+{
+  if (!ready_open_log(rw)) return 0;
+  struct stat sb;
+  if (fstat(rw->log_fd, &sb) == 0 && sb.st_size < rw->pos) {
+    rw->pos = 0;                // truncated and rewritten in place
+    rw->line_len = 0;
+  }
+
+  char buf[16384];
+  ssize_t n;
+  while ((n = pread(rw->log_fd, buf, sizeof(buf), rw->pos)) > 0) {
+    rw->pos += n;
+    for (ssize_t i = 0; i < n; i++) {
+      if (buf[i] != '\n') {
+        if (rw->line_len < sizeof(rw->line) - 1) rw->line[rw->line_len++] = buf[i];
+        continue;
+      }
+      rw->line[rw->line_len] = '\0';
+      rw->line_len = 0;
+      if (!marker || strstr(rw->line, marker)) return 1;
+    }
+  }
+  return 0;
+}
+
+// What the current log holds so far does not count.
+static void ready_skip(ready_watch *rw)
+{
+  struct stat sb;
+  ready_follow(rw);
+  if (rw->dir[0] && ready_open_log(rw) && fstat(rw->log_fd, &sb) == 0) rw->pos = sb.st_size;
+  rw->line_len = 0;
+}
+
+// Before the stop. 0 when inotify is unavailable.
+static int ready_begin(ready_watch *rw)
+{
+  memset(rw, 0, sizeof(*rw));
+  rw->wd_dir = rw->log_fd = -1;
+  rw->ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (rw->ifd < 0) return 0;
+
+  char d[PATH_MAX];
+  snprintf(d, sizeof(d), "%s", last_temp_file());
+  char *slash = strrchr(d, '/');
+  if (slash) *slash = '\0';
+  else snprintf(d, sizeof(d), ".");
+  (void)inotify_add_watch(rw->ifd, d, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+
+  ready_skip(rw);
+  return 1;
+}
+
+static void ready_end(ready_watch *rw)
+{
+  if (rw->log_fd >= 0) close(rw->log_fd);
+  if (rw->ifd >= 0) close(rw->ifd);
+}
+
+// After the start: 0 when ready, 124 at the deadline, 130 on Ctrl-C.
+static int ready_wait(ready_watch *rw, const char *marker, long deadline)
+{
+  for (;;) {
+    ready_follow(rw);
+    if (rw->dir[0] && ready_scan(rw, marker)) return 0;
+
+    int timeout = -1;
+    if (deadline) {
+      long ms = (deadline - mono_ns() + 999999L) / 1000000L;
+      if (ms <= 0) return 124;
+      timeout = ms > INT_MAX ? INT_MAX : (int)ms;
+    }
+    // a dir that could not be watched (not there yet) is polled
+    if (rw->dir[0] && rw->wd_dir < 0 && (timeout < 0 || timeout > 100)) timeout = 100;
+    struct pollfd pf = { .fd = rw->ifd, .events = POLLIN };
+    int n = poll(&pf, 1, timeout);
+    if (n < 0 && errno == EINTR) {
+      if (g_interrupted) return 130;
+      continue;
+    }
+    if (n < 0) return 1;
+    char ev[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (read(rw->ifd, ev, sizeof(ev)) > 0) {}
+  }
+}
+
+// ====== builtins (parent-only) ======
+static int sh_help(char **args) { (void)args; print_usage(); return 0; }
+
+// exit [N]: leave after the current line with N (default: last rc).
+static int sh_exit(char **args)
+{
+  int rc = g_last_rc;
+  if (args[1]) {
+    char *end;
+    long v = strtol(args[1], &end, 10);
+    if (*end || end == args[1]) {
+      fprintf(stderr, "trade: exit: %s: numeric argument required\n", args[1]);
+      return 2;
+    }
+    rc = (int)(v & 0xff);
+  }
+  g_exit_requested = 1;
+  return rc;
+}
+
+
+static char *trim_ws(char *s)
+{
+  while (*s && isspace((unsigned char)*s)) s++;
+  if (*s == '\0') return s;
+
+  char *end = s + strlen(s) - 1;
+  while (end > s && isspace((unsigned char)*end)) {
+    *end = '\0';
+    end--;
+  }
+  return s;
+}
+
+static int ends_with(const char *s, const char *suffix)
+{
+  size_t ls = strlen(s);
+  size_t lf = strlen(suffix);
+  if (ls < lf) return 0;
+  return strcmp(s + (ls - lf), suffix) == 0;
+}
+
+static int split_key_value(const char *line,
+                           char *keybuf, size_t keybuf_sz,
+                           char *valbuf, size_t valbuf_sz)
+{
+  if (!line || !keybuf || !valbuf || keybuf_sz == 0 || valbuf_sz == 0) return 0;
+
+  char tmp[4096];
+  snprintf(tmp, sizeof(tmp), "%s", line);
+
+  char *p = trim_ws(tmp);
+  if (*p == '\0' || *p == '#') return 0;
+  if (strchr(p, '<') != NULL || strchr(p, '>') != NULL) {
+      return 0;
+  }
+  char *eq = strchr(p, '=');
+  if (!eq) return 0;
+
+  *eq = '\0';
+  char *key = trim_ws(p);
+  char *val = trim_ws(eq + 1);
+
+  if (*key == '\0') return 0;
+
+  snprintf(keybuf, keybuf_sz, "%s", key);
+  snprintf(valbuf, valbuf_sz, "%s", val);
+  return 1;
+}
+
+static int find_key_value_in_file(const char *path, const char *target_key,
+                                  char *valbuf, size_t valbuf_sz)
+{
+  FILE *fp = fopen(path, "r");
+  if (!fp) return 0;
+
+  char line[4096];
+  char key[1024];
+  char val[4096];
+  int found = 0;
+
+  while (fgets(line, sizeof(line), fp)) {
+    if (!split_key_value(line, key, sizeof(key), val, sizeof(val))) {
+      continue;
+    }
+
+    if (strcmp(key, target_key) == 0) {
+      snprintf(valbuf, valbuf_sz, "%s", val);
+      found = 1;
+      break;
+    }
+  }
+
+  fclose(fp);
+  return found;
+}
+
+static int merge_rpmnew_file(const char *orig_path, const char *rpmnew_path)
+{
+  FILE *src = fopen(rpmnew_path, "r");
+  if (!src) {
+    fprintf(stderr, "trade: merge: cannot open rpmnew: %s (%s)\n",
+            rpmnew_path, strerror(errno));
+    return 1;
+  }
+
+  FILE *dst = fopen(orig_path, "a");
+  if (!dst) {
+    fclose(src);
+    fprintf(stderr, "trade: merge: cannot open original: %s (%s)\n",
+            orig_path, strerror(errno));
+    return 1;
+  }
+
+  char line[4096];
+  char key[1024];
+  char rpmnew_val[4096];
+  char orig_val[4096];
+  int added = 0;
+
+  while (fgets(line, sizeof(line), src)) {
+    if (!split_key_value(line, key, sizeof(key), rpmnew_val, sizeof(rpmnew_val))) {
+      continue;
+    }
+
+    if (find_key_value_in_file(orig_path, key, orig_val, sizeof(orig_val))) {
+      if (strcmp(orig_val, rpmnew_val) != 0) {
+        printf("trade: merge: changed key skipped '%s'\n", key);
+      }
+      continue;
+    }
+
+    fprintf(dst, "\n%s", line);
+    if (line[strlen(line) - 1] != '\n') {
+      fputc('\n', dst);
+    }
+    added++;
+    printf("trade: merge: added key '%s' to %s\n", key, orig_path);
+  }
+
+  fclose(src);
+  fclose(dst);
+
+  if (added > 0) {
+  char merged_path[PATH_MAX];
+
+  // ".merged" 分の余裕チェック（7文字 + NULL）
+  if (strlen(rpmnew_path) < sizeof(merged_path) - 8) {
+
+    snprintf(merged_path, sizeof(merged_path), "%s.merged", rpmnew_path);
+
+    if (rename(rpmnew_path, merged_path) == 0) {
+      printf("trade: merge: renamed %s -> %s\n", rpmnew_path, merged_path);
+    } else {
+      fprintf(stderr, "trade: merge: rename failed: %s (%s)\n",
+              rpmnew_path, strerror(errno));
+    }
+
+  } else {
+    fprintf(stderr, "trade: merge: path too long, skip rename: %s\n", rpmnew_path);
+  }
+}
+
+  return 0;
+}
+
+static int merge_rpmnew_in_dir(const char *dirpath)
+{
+  DIR *dir = opendir(dirpath);
+  if (!dir) {
+    fprintf(stderr, "trade: merge: cannot open dir: %s (%s)\n",
+            dirpath, strerror(errno));
+    return 1;
+  }
+
+  struct dirent *ent;
+  int processed = 0;
 
   while ((ent = readdir(dir)) != NULL) {
     if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
       continue;
     }
 
-    if (!ends_with(ent->d_name, ".rpmnew")) {
-      continue;
+    if (!ends_with(ent->d_name, ".rpmnew")) {
+      continue;
+    }
+
+    char rpmnew_path[PATH_MAX];
+    char orig_path[PATH_MAX];
+    char base[PATH_MAX];
+
+    snprintf(rpmnew_path, sizeof(rpmnew_path), "%s/%s", dirpath, ent->d_name);
+    snprintf(base, sizeof(base), "%s", ent->d_name);
+
+    size_t len = strlen(base);
+    if (len < 7) continue;
+    base[len - 7] = '\0';
+
+    snprintf(orig_path, sizeof(orig_path), "%s/%s", dirpath, base);
+
+    if (access(orig_path, F_OK) != 0) {
+      fprintf(stderr, "trade: merge: original not found for %s\n", rpmnew_path);
+      continue;
+    }
+
+    printf("trade: merge: checking %s\n", rpmnew_path);
+    merge_rpmnew_file(orig_path, rpmnew_path);
+    processed++;
+  }
+
+  closedir(dir);
+
+  if (processed == 0) {
+    printf("trade: merge: no .rpmnew files found in %s\n", dirpath);
+  }
+
+  return 0;
+}
+
+static int sh_merge_rpmnew(char **args)
+{
+  (void)args;
+  return merge_rpmnew_in_dir("/etc/AutoTrade");
+}
+
+static int sh_cd(char **args)
+{
+  const char *home = getenv("HOME");
+  const char *target = NULL;
+
+  if (!args[1] || strcmp(args[1], "~") == 0) {
+    target = (home && *home) ? home : "/";
+  } else if (args[1][0] == '~' && args[1][1] == '/') {
+    if (!home || !*home) {
+      fprintf(stderr, "trade: cd: HOME is not set\n");
+      return 1;
+    }
+    size_t len = strlen(home) + strlen(args[1]);
+    char *buf = malloc(len + 1);
+    if (!buf) { perror("trade: malloc"); return 1; }
+    strcpy(buf, home);
+    strcat(buf, args[1] + 1); // skip '~'
+    int rc = 0;
+    if (chdir(buf) != 0) {
+      fprintf(stderr, "trade: cd: %s: %s\n", buf, strerror(errno));
+      rc = 1;
+    }
+    free(buf);
+    return rc;
+  } else {
+    target = args[1];
+  }
+
+  if (chdir(target) != 0) {
+    fprintf(stderr, "trade: cd: %s: %s\n", target, strerror(errno));
+    return 1;
+  }
+  return 0;
+}
+
+static int sh_pwd(char **args)
+{
+  (void)args;
+  char *cwd = getcwd(NULL, 0);
+  if (!cwd) {
+    fprintf(stderr, "trade: pwd: %s\n", strerror(errno));
+    return 1;
+  }
+  puts(cwd);
+  free(cwd);
+  return 0;
+}
+
+// [sudo] systemctl VERB SERVICE_NAME, as described by the command's
+// registry entry.
+static int run_systemctl(cmd_id id)
+{
+  char **argv = cmd_build_argv(&cmd_table[id], NULL);
+  if (!argv) return 1;
+  return run_cmd_capture_rc(argv);
+}
+
+// status without spawning anything: the cgroup, else the bus; -1 when
+// neither can answer.
+static int status_native(void)
+{
+  int rc = cgroup_status();
+  return rc >= 0 ? rc : dbus_unit_status();
+}
+
+// start/stop/restart/status: systemd over D-Bus (status: the cgroup
+// first), or systemctl when those cannot answer.
+static int run_service_verb(cmd_id id)
+{
+  int rc;
+  switch (id) {
+  case CMD_START:   rc = dbus_unit_job("StartUnit", "start"); break;
+  case CMD_STOP:    rc = dbus_unit_job("StopUnit", "stop"); break;
+  case CMD_RESTART: rc = dbus_unit_job("RestartUnit", "restart"); break;
+  case CMD_STATUS:  rc = status_native(); break;
+  default:          rc = -1; break;
+  }
+  return rc >= 0 ? rc : run_systemctl(id);
+}
+
+static int sh_start(char **args)
+{
+  (void)args;
+  int rc = run_service_verb(CMD_START);
+  if (rc == 0) puts("trade: started.");
+  else fprintf(stderr, "trade: start failed (rc=%d)\n", rc);
+  return rc;
+}
+
+static int sh_stop(char **args)
+{
+  (void)args;
+  int rc = run_service_verb(CMD_STOP);
+  if (rc == 0) puts("trade: stopped.");
+  else fprintf(stderr, "trade: stop failed (rc=%d)\n", rc);
+  return rc;
+}
+
+// restart --wait [MARKER]: stop and start as two jobs, then wait for the
+// bot to log MARKER (default $TRADE_READY_MARKER, else any line) and
+// report each phase. `set readytimeout` counts from the stop.
+static int restart_wait(const char *marker)
+{
+  if (!marker || !*marker) marker = getenv("TRADE_READY_MARKER");
+  if (marker && !*marker) marker = NULL;
+
+  ready_watch rw;
+  if (!ready_begin(&rw)) {
+    perror("trade: restart: inotify");
+    return 1;
+  }
+  long t0 = mono_ns(), tr0 = trace_now();
+  long deadline = g_opt.readytimeout_ms ? t0 + g_opt.readytimeout_ms * 1000000L : 0;
+  if (g_cmd_deadline_ns && (!deadline || g_cmd_deadline_ns < deadline)) deadline = g_cmd_deadline_ns;
+  char b[32];
+
+  int rc = run_service_verb(CMD_STOP);
+  long t1 = mono_ns();
+  if (rc != 0) {
+    fprintf(stderr, "trade: stop failed (rc=%d)\n", rc);
+    ready_end(&rw);
+    return rc;
+  }
+  printf("trade: stopped in %s\n", fmt_ns(b, sizeof(b), t1 - t0));
+  ready_skip(&rw);              // nor do the bot's shutdown lines
+
+  rc = run_service_verb(CMD_START);
+  long t2 = mono_ns();
+  if (rc != 0) {
+    fprintf(stderr, "trade: start failed (rc=%d)\n", rc);
+    ready_end(&rw);
+    return rc;
+  }
+  printf("trade: started in %s\n", fmt_ns(b, sizeof(b), t2 - t1));
+  fflush(stdout);
+
+  rc = ready_wait(&rw, marker, deadline);
+  long t3 = mono_ns();
+  trace_add("ready", tr0, trace_now(), 0, marker ? marker : "");
+  if (rc == 0) {
+    printf("trade: ready in %s (%s/%s)\n", fmt_ns(b, sizeof(b), t3 - t2), rw.dir, DEBUG_LOG_NAME);
+    printf("trade: restarted; down %s\n", fmt_ns(b, sizeof(b), t3 - t0));
+  } else if (rc == 124) {
+    fprintf(stderr, "trade: restart: not ready after %s (", fmt_ns(b, sizeof(b), t3 - t0));
+    if (!rw.dir[0]) fprintf(stderr, "%s names no /tmp dir)\n", last_temp_file());
+    else if (marker) fprintf(stderr, "no \"%s\" in %s/%s)\n", marker, rw.dir, DEBUG_LOG_NAME);
+    else fprintf(stderr, "nothing new in %s/%s)\n", rw.dir, DEBUG_LOG_NAME);
+  } else if (rc != 130) {
+    perror("trade: restart: inotify");
+  }
+  ready_end(&rw);
+  return rc;
+}
+
+static int sh_restart(char **args)
+{
+  if (args[1]) {
+    if (strcmp(args[1], "--wait") != 0 || (args[2] && args[3])) {
+      fprintf(stderr, "trade: usage: restart [--wait [MARKER]]\n");
+      return 2;
     }
+    return restart_wait(args[2]);
+  }
+  int rc = run_service_verb(CMD_RESTART);
+  if (rc == 0) puts("trade: restarted.");
+  else fprintf(stderr, "trade: restart failed (rc=%d)\n", rc);
+  return rc;
+}
 
-    char rpmnew_path[PATH_MAX];
-    char orig_path[PATH_MAX];
-    char base[PATH_MAX];
+// status [--full]: --full is always the complete `systemctl status`,
+// with its journal lines.
+static int sh_status(char **args)
+{
+  int full = args && args[1] && strcmp(args[1], "--full") == 0;
+  if (args && args[1] && (!full || args[2])) {
+    fprintf(stderr, "trade: usage: status [--full]\n");
+    return 2;
+  }
+  int rc = full ? run_systemctl(CMD_STATUS) : run_service_verb(CMD_STATUS);
+  if (rc != 0) fprintf(stderr, "trade: status returned rc=%d\n", rc);
+  return rc;
+}
 
-    snprintf(rpmnew_path, sizeof(rpmnew_path), "%s/%s", dirpath, ent->d_name);
-    snprintf(base, sizeof(base), "%s", ent->d_name);
+static int sh_arena(char **args)
+{
+  (void)args;
+  arena *a = &g_arena;
+  size_t peak = a->peak_line_bytes > a->line_bytes ? a->peak_line_bytes : a->line_bytes;
+  printf("arena: lines=%lu allocs_avoided=%lu bytes=%lu\n", a->lines, a->allocs, a->bytes);
+  printf("arena: chunks=%d chunk_size=%d peak_line_bytes=%zu\n",
+         a->chunks, ARENA_CHUNK_SIZE, peak);
+  if (a->lines > 0)
+    printf("arena: avg_allocs_per_line=%.1f\n", (double)a->allocs / (double)a->lines);
+  return 0;
+}
 
-    size_t len = strlen(base);
-    if (len < 7) continue;
-    base[len - 7] = '\0';
+static int sh_hash(char **args)
+{
+  if (args && args[1] && strcmp(args[1], "-r") == 0) {
+    exe_cache_invalidate_all();
+    puts("trade: hash: cache cleared");
+    return 0;
+  }
 
-    snprintf(orig_path, sizeof(orig_path), "%s/%s", dirpath, base);
+  exe_cache_poll();
+  double saved_us = 0;
+  printf("%6s %8s %6s %10s  %s\n", "hits", "resolves", "probes", "saved_us", "command");
+  for (int i = 0; i < g_exe_cache_len; i++) {
+    const exe_cache_entry *e = &g_exe_cache[i];
+    // each hit skips one PATH walk of the measured cost
+    double us = (double)e->hits * (double)e->resolve_ns / 1000.0;
+    saved_us += us;
+    printf("%6lu %8lu %6d %10.1f  %s%s\n", e->hits, e->resolves, e->probes, us,
+           e->path[0] ? e->path : e->name,
+           !e->valid ? " (stale)" : (e->path[0] ? "" : " (not found)"));
+  }
+  printf("trade: hash: %s invalidation, est. %.1f us of PATH search saved\n",
+         g_exe_inotify >= 0 ? "inotify" : "mtime", saved_us);
+  return 0;
+}
 
-    if (access(orig_path, F_OK) != 0) {
-      fprintf(stderr, "trade: merge: original not found for %s\n", rpmnew_path);
-      continue;
+// set [NAME [VALUE]]: show or change a shell option.
+typedef enum { OPT_SIZE, OPT_BOOL, OPT_DURATION } opt_type;
+
+typedef struct {
+  const char *name;
+  opt_type type;
+  long *val;
+  const char *help;
+} shell_opt;
+
+static const shell_opt g_shell_opts[] = {
+  { "pipesize",    OPT_SIZE,     &g_opt.pipe_size,      "pipeline pipe buffer (0 = kernel default)" },
+  { "pipefail",    OPT_BOOL,     &g_opt.pipefail,       "pipeline fails if any stage fails" },
+  { "timeout",     OPT_DURATION, &g_opt.timeout_ms,     "limit for every spawned command (0 = none)" },
+  { "privtimeout", OPT_DURATION, &g_opt.privtimeout_ms, "limit for sudo commands (0 = none)" },
+  { "privhelper",  OPT_BOOL,     &g_opt.privhelper,     "sudo commands via one root helper" },
+  { "dbus",        OPT_BOOL,     &g_opt.dbus,           "service verbs over D-Bus, not systemctl" },
+  { "readytimeout", OPT_DURATION, &g_opt.readytimeout_ms, "restart --wait: stop to ready (0 = none)" },
+};
+#define N_SHELL_OPTS ((int)(sizeof(g_shell_opts) / sizeof(g_shell_opts[0])))
+
+// /proc/sys/fs/pipe-max-size, read once.
+static long pipe_max_size(void)
+{
+  static long max = 0;
+  if (max) return max;
+  max = 1 << 20;
+  FILE *fp = fopen("/proc/sys/fs/pipe-max-size", "r");
+  if (fp) {
+    long v;
+    if (fscanf(fp, "%ld", &v) == 1 && v > 0) max = v;
+    fclose(fp);
+  }
+  return max;
+}
+
+static void opt_print(const shell_opt *o)
+{
+  char buf[32];
+  long v = *o->val;
+  switch (o->type) {
+  case OPT_SIZE:
+    if (v && v % (1 << 20) == 0) snprintf(buf, sizeof(buf), "%ldM", v >> 20);
+    else if (v && v % 1024 == 0) snprintf(buf, sizeof(buf), "%ldK", v >> 10);
+    else snprintf(buf, sizeof(buf), "%ld", v);
+    break;
+  case OPT_BOOL:
+    snprintf(buf, sizeof(buf), "%s", v ? "on" : "off");
+    break;
+  case OPT_DURATION:
+    if (v % 1000 == 0) snprintf(buf, sizeof(buf), "%lds", v / 1000);
+    else snprintf(buf, sizeof(buf), "%.3gs", (double)v / 1000.0);
+    break;
+  }
+  printf("%-12s %-8s # %s\n", o->name, buf, o->help);
+}
+
+// "90", "1.5", "30s", "5m", "1h" -> milliseconds
+static int parse_duration_ms(const char *s, long *out)
+{
+  char *end;
+  errno = 0;
+  double v = strtod(s, &end);
+  if (errno || end == s || v < 0) return 0;
+  if (*end == 's') end++;
+  else if (*end == 'm') { v *= 60; end++; }
+  else if (*end == 'h') { v *= 3600; end++; }
+  if (*end || v > (double)(LONG_MAX / 1000000000L)) return 0;
+  *out = (long)(v * 1000.0 + 0.5);
+  return 1;
+}
+
+static int opt_parse(const shell_opt *o, const char *s, long *out)
+{
+  if (o->type == OPT_DURATION) return parse_duration_ms(s, out);
+  if (o->type == OPT_BOOL) {
+    if (strcmp(s, "on") == 0 || strcmp(s, "1") == 0) *out = 1;
+    else if (strcmp(s, "off") == 0 || strcmp(s, "0") == 0) *out = 0;
+    else return 0;
+    return 1;
+  }
+
+  char *end;
+  errno = 0;
+  long v = strtol(s, &end, 10);
+  if (errno || end == s || v < 0) return 0;
+  if (*end == 'K' || *end == 'k') { v <<= 10; end++; }
+  else if (*end == 'M' || *end == 'm') { v <<= 20; end++; }
+  if (*end) return 0;
+  if (v > pipe_max_size()) {
+    fprintf(stderr, "trade: set: %s capped at pipe-max-size (%ld)\n", o->name, pipe_max_size());
+    v = pipe_max_size();
+  }
+  *out = v;
+  return 1;
+}
+
+static int sh_set(char **args)
+{
+  if (!args[1]) {
+    for (int i = 0; i < N_SHELL_OPTS; i++) opt_print(&g_shell_opts[i]);
+    return 0;
+  }
+
+  const shell_opt *o = NULL;
+  for (int i = 0; i < N_SHELL_OPTS; i++) {
+    if (strcmp(args[1], g_shell_opts[i].name) == 0) o = &g_shell_opts[i];
+  }
+  if (!o) {
+    fprintf(stderr, "trade: set: unknown option: %s\n", args[1]);
+    return 1;
+  }
+  if (!args[2]) {
+    opt_print(o);
+    return 0;
+  }
+
+  long v;
+  if (args[3] || !opt_parse(o, args[2], &v)) {
+    fprintf(stderr, "trade: set: invalid value for %s: %s\n", o->name, args[2]);
+    return 1;
+  }
+  if (o->val == &g_opt.privhelper && v && !*o->val) fputs(PRIV_WARNING, stderr);
+  *o->val = v;
+  return 0;
+}
+
+static int sh_stats(char **args)
+{
+  if (args[1] && strcmp(args[1], "-r") == 0) {
+    for (int i = 0; i < CMD_NCOMMANDS; i++) { free(g_stats[i]); g_stats[i] = NULL; }
+    puts("trade: stats: cleared");
+    return 0;
+  }
+
+  int any = 0;
+  long v[STATS_SAMPLES];
+  char b[5][32];
+  for (int i = 0; i < CMD_NCOMMANDS; i++) {
+    const cmd_stats *st = g_stats[i];
+    if (!st) continue;
+    if (!any) {
+      printf("%-13s %6s %9s %9s %9s %9s %9s %8s\n",
+             "command", "count", "p50", "p95", "max", "user", "sys", "maxrss");
+      any = 1;
     }
+    int n = st->count < STATS_SAMPLES ? (int)st->count : STATS_SAMPLES;
+    memcpy(v, st->samples, (size_t)n * sizeof(long));
+    qsort(v, (size_t)n, sizeof(long), cmp_long);
+    // nearest rank
+    long p50 = v[(n * 50 + 99) / 100 - 1], p95 = v[(n * 95 + 99) / 100 - 1];
+    printf("%-13s %6lu %9s %9s %9s %9s %9s %7.1fM\n", cmd_table[i].name, st->count,
+           fmt_ns(b[0], sizeof(b[0]), p50), fmt_ns(b[1], sizeof(b[1]), p95),
+           fmt_ns(b[2], sizeof(b[2]), st->max_ns),
+           fmt_ns(b[3], sizeof(b[3]), st->use.user_us * 1000L),
+           fmt_ns(b[4], sizeof(b[4]), st->use.sys_us * 1000L),
+           (double)st->use.maxrss_kb / 1024.0);
+  }
+  if (!any) puts("trade: stats: nothing run yet");
+  return 0;
+}
 
-    printf("trade: merge: checking %s\n", rpmnew_path);
-    merge_rpmnew_file(orig_path, rpmnew_path);
-    processed++;
+static int sh_trace(char **args)
+{
+  const char *sub = args[1];
+  if (!sub) {
+    unsigned long n = g_trace_n < TRACE_EVENTS ? g_trace_n : TRACE_EVENTS;
+    printf("trace: %s, %lu events (ring of %d)\n", g_trace_on ? "on" : "off", n, TRACE_EVENTS);
+  } else if (strcmp(sub, "on") == 0) {
+    if (!g_trace && !(g_trace = calloc(TRACE_EVENTS, sizeof(*g_trace)))) {
+      perror("trade: trace");
+      return 1;
+    }
+    g_trace_n = 0;
+    g_trace_on = 1;
+  } else if (strcmp(sub, "off") == 0) {
+    g_trace_on = 0;
+  } else if (strcmp(sub, "dump") == 0 && args[2] && !args[3]) {
+    long n = trace_dump(args[2]);
+    if (n < 0) {
+      fprintf(stderr, "trade: trace: %s: %s\n", args[2], strerror(errno));
+      return 1;
+    }
+    printf("trace: wrote %ld events to %s\n", n, args[2]);
+  } else {
+    fprintf(stderr, "trade: usage: trace [on|off|dump FILE]\n");
+    return 1;
   }
+  return 0;
+}
 
-  closedir(dir);
+// ====== native commands ======
+// Exec-style commands that can run inside the shell. prepare (the
+// registry's `native` hook) runs in the main thread and opens what it
+// needs, so it can still decline and let the exec path (sudo, coreutils)
+// handle options or files the shell itself cannot read. run() then only
+// moves data between fd_in and fd_out: inline for a single command, on a
+// thread per chain of native stages inside a pipeline.
+//
+// A stage that only reads stdin also gets push/finish: inside a pipeline
+// the stage before it hands over its output buffers by calling push()
+// directly, so a run like `cat log | grep X | grep -v Y` is one pass over
+// the data on one thread, with no pipe in between.
+#define NATIVE_IO_CHUNK (1 << 20)
+
+struct native_stage {
+  int (*run)(native_stage *st, int fd_in, int fd_out);   // returns rc
+  char **args;
+  int *fds;              // opened by prepare; -1 = stdin, -2 = already closed
+  int nfds;
+  void *ctx;             // command specific state
+  void (*cleanup)(native_stage *st);
+
+  // stdin-only filters; push returns nonzero once it takes no more input
+  int (*push)(native_stage *st, const char *p, size_t n);
+  int (*finish)(native_stage *st);                        // returns rc
+  native_stage *next;    // fused downstream stage, NULL = write to fd_out
+
+  // pipeline runner state
+  int fd_in, fd_out;
+  int close_in, close_out;
+  pthread_t tid;
+  int started;
+  int done_fd;           // eventfd poked by the thread when the chain ends
+  int finished;
+  struct rusage ru;      // what the chain's thread used (RUSAGE_THREAD)
+  int os_tid;            // thread that ran the chain, for `trace`
+  int rc;
+};
 
-  if (processed == 0) {
-    printf("trade: merge: no .rpmnew files found in %s\n", dirpath);
+static void native_release(native_stage *st)
+{
+  for (int i = 0; i < st->nfds; i++) {
+    if (st->fds[i] >= 0) close(st->fds[i]);
+    st->fds[i] = -2;
   }
+  if (st->cleanup) st->cleanup(st);
+  st->cleanup = NULL;
+}
 
+static int write_all(int fd, const char *p, size_t n)
+{
+  while (n) {
+    ssize_t w = write(fd, p, n);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      return errno;
+    }
+    p += w;
+    n -= (size_t)w;
+  }
   return 0;
 }
 
-static int sh_merge_rpmnew(char **args)
+// Copy all of `in` to `out`: copy_file_range between regular files,
+// sendfile from a regular file, splice when either side is a pipe, and
+// read/write for everything else (ttys, sockets, unsupported fs).
+// Returns 0 or an errno value (EINTR after Ctrl-C); *write_side tells
+// which fd failed.
+static int copy_fd(int in, int out, int *write_side)
 {
-  (void)args;
-  merge_rpmnew_in_dir("/etc/AutoTrade");
+  struct stat si, so;
+  int in_reg = fstat(in, &si) == 0 && S_ISREG(si.st_mode);
+  int in_pipe = !in_reg && S_ISFIFO(si.st_mode);
+  int out_reg = fstat(out, &so) == 0 && S_ISREG(so.st_mode);
+  int out_pipe = !out_reg && S_ISFIFO(so.st_mode);
+  ssize_t n;
+  *write_side = 0;
+
+#define COPY_FALLBACK(e) ((e) == EINVAL || (e) == ENOSYS || (e) == EXDEV || \
+                          (e) == EOPNOTSUPP || (e) == EBADF)
+  if (in_reg && out_reg) {
+    while ((n = copy_file_range(in, NULL, out, NULL, NATIVE_IO_CHUNK, 0)) > 0 && !g_interrupted) {}
+    if (g_interrupted) return EINTR;
+    if (n == 0) return 0;
+    if (!COPY_FALLBACK(errno)) { *write_side = (errno != EIO); return errno; }
+  }
+  if (in_reg) {
+    while ((n = sendfile(out, in, NULL, NATIVE_IO_CHUNK)) > 0 && !g_interrupted) {}
+    if (g_interrupted) return EINTR;
+    if (n == 0) return 0;
+    if (errno == EPIPE) { *write_side = 1; return EPIPE; }
+    if (errno != EINTR && !COPY_FALLBACK(errno)) { *write_side = 1; return errno; }
+  } else if (in_pipe || out_pipe) {
+    while ((n = splice(in, NULL, out, NULL, NATIVE_IO_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE)) > 0 &&
+           !g_interrupted) {}
+    if (g_interrupted) return EINTR;
+    if (n == 0) return 0;
+    if (errno == EPIPE) { *write_side = 1; return EPIPE; }
+    if (errno != EINTR && !COPY_FALLBACK(errno)) return errno;
+  }
+#undef COPY_FALLBACK
+
+  char *buf = malloc(NATIVE_IO_CHUNK);
+  if (!buf) return ENOMEM;
+  int err = 0;
+  for (;;) {
+    if (g_interrupted) { err = EINTR; break; }
+    n = read(in, buf, NATIVE_IO_CHUNK);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      err = errno;
+      break;
+    }
+    if (n == 0) break;
+    if ((err = write_all(out, buf, (size_t)n)) != 0) {
+      *write_side = 1;
+      break;
+    }
+  }
+  free(buf);
+  return err;
+}
+
+// Read all of `in` and hand it to the fused downstream stage. A refused
+// push reads as EPIPE on the write side, as if the reader had gone away.
+static int pump_fd(int in, native_stage *next, int *write_side)
+{
+  *write_side = 0;
+  char *buf = malloc(NATIVE_IO_CHUNK);
+  if (!buf) return ENOMEM;
+  int err = 0;
+  for (;;) {
+    if (g_interrupted) { err = EINTR; break; }
+    ssize_t n = read(in, buf, NATIVE_IO_CHUNK);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      err = errno;
+      break;
+    }
+    if (n == 0) break;
+    if (next->push(next, buf, (size_t)n)) {
+      err = EPIPE;
+      *write_side = 1;
+      break;
+    }
+  }
+  free(buf);
+  return err;
+}
+
+static int native_cat_run(native_stage *st, int fd_in, int fd_out)
+{
+  int rc = 0;
+  for (int i = 0; i < st->nfds; i++) {
+    int fd = (st->fds[i] == -1) ? fd_in : st->fds[i];
+    int write_side = 0;
+    int err = st->next ? pump_fd(fd, st->next, &write_side)
+                       : copy_fd(fd, fd_out, &write_side);
+    if (st->fds[i] >= 0) close(st->fds[i]);
+    st->fds[i] = -2;
+
+    if (err == EPIPE) { rc = 128 + SIGPIPE; break; }   // like a killed cat
+    if (err == EINTR) { rc = 128 + SIGINT; break; }
+    if (err && write_side) {
+      fprintf(stderr, "cat: write error: %s\n", strerror(err));
+      rc = 1;
+      break;
+    }
+    if (err) {
+      const char *name = (i + 1 < st->nfds || st->args[1]) ? st->args[i + 1] : "-";
+      fprintf(stderr, "cat: %s: %s\n", name ? name : "-", strerror(err));
+      rc = 1;
+    }
+  }
+  native_release(st);
+  return rc;
+}
+
+// A fused `| cat |` passes its input through unchanged.
+static int native_cat_push(native_stage *st, const char *p, size_t n)
+{
+  if (st->rc) return 1;
+  int err = st->next ? (st->next->push(st->next, p, n) ? EPIPE : 0)
+                     : write_all(st->fd_out, p, n);
+  if (!err) return 0;
+  if (err == EPIPE) {
+    st->rc = 128 + SIGPIPE;
+  } else {
+    fprintf(stderr, "cat: write error: %s\n", strerror(err));
+    st->rc = 1;
+  }
+  return 1;
+}
+
+static int native_cat_finish(native_stage *st)
+{
+  native_release(st);
+  return st->rc;
+}
+
+// cat/scat [FILE...]: native when there are no options and every file
+// opens without privileges; otherwise [sudo] cat does the job.
+static int native_cat_prepare(char **args, native_stage *st)
+{
+  int n = 0;
+  for (int i = 1; args[i]; i++) {
+    if (args[i][0] == '-' && args[i][1] != '\0') return 0;
+    n++;
+  }
+
+  int *fds = arena_alloc(&g_arena, (size_t)(n ? n : 1) * sizeof(int));
+  if (!fds) return 0;
+
+  if (n == 0) {
+    fds[0] = -1;
+    n = 1;
+  }
+  for (int i = 0; i < n && args[i + 1]; i++) {
+    if (strcmp(args[i + 1], "-") == 0) { fds[i] = -1; continue; }
+    fds[i] = open(args[i + 1], O_RDONLY | O_CLOEXEC);
+    if (fds[i] < 0) {
+      while (--i >= 0) if (fds[i] >= 0) close(fds[i]);
+      return 0;
+    }
+  }
+
+  memset(st, 0, sizeof(*st));
+  st->run = native_cat_run;
+  st->args = args;
+  st->fds = fds;
+  st->nfds = n;
+  if (n == 1 && fds[0] == -1) {
+    st->push = native_cat_push;
+    st->finish = native_cat_finish;
+  }
   return 1;
 }
 
-static int sh_cd(char **args)
+// ---- buffered fd writer (native commands do not use stdio) ----
+// With `next` set the buffer is pushed into the fused downstream stage
+// instead of being written.
+typedef struct {
+  int fd;
+  native_stage *next;
+  int err;               // first write errno (EPIPE when next refused)
+  size_t len;
+  char buf[64 * 1024];
+} out_buf;
+
+static void ob_send(out_buf *ob, const char *p, size_t n)
+{
+  if (ob->next) {
+    if (ob->next->push(ob->next, p, n)) ob->err = EPIPE;
+  } else {
+    ob->err = write_all(ob->fd, p, n);
+  }
+}
+
+static void ob_flush(out_buf *ob)
+{
+  if (ob->len && !ob->err) ob_send(ob, ob->buf, ob->len);
+  ob->len = 0;
+}
+
+static void ob_write(out_buf *ob, const char *p, size_t n)
+{
+  if (ob->err) return;
+  if (n >= sizeof(ob->buf)) {
+    ob_flush(ob);
+    if (!ob->err) ob_send(ob, p, n);
+    return;
+  }
+  if (ob->len + n > sizeof(ob->buf)) ob_flush(ob);
+  memcpy(ob->buf + ob->len, p, n);
+  ob->len += n;
+}
+
+// ---- grep ----
+// grep [-icnvFE]... PATTERN [FILE...]. Literal patterns use memmem (glibc
+// two-way, vectorized) or a SIMD first-byte scan for -i; anything else is
+// a POSIX regex (glibc compiles it to a DFA) kept in a small per-session
+// cache. Other options, and files the shell cannot read, go to [sudo] grep.
+#define GREP_RE_CACHE 8
+
+typedef struct {
+  char *pat;
+  int cflags;
+  regex_t re;
+  int refs;              // stages currently using it; never evicted while > 0
+  unsigned long last_use;
+} grep_re;
+
+static grep_re g_grep_re[GREP_RE_CACHE];
+static unsigned long g_grep_re_clock;
+static unsigned long g_grep_re_hits, g_grep_re_misses;
+
+typedef struct {
+  int icase, invert, count, lineno, extended, fixed;
+  const char *pat;
+  size_t patlen;
+  char *fold;            // lowercased pattern for -i literal search
+  int literal;
+  grep_re *re;
+  regex_t *own_re;       // compiled outside the cache (cache full of busy entries)
+  int multi;             // several files: prefix "NAME:"
+
+  // stream state
+  out_buf *ob;
+  unsigned long lno, hits;
+  char *tail;            // partial last line carried to the next block
+  size_t tail_len, tail_cap;
+  int err;
+} grep_opts;
+
+// Compiled pattern from the cache; the caller holds a reference.
+static grep_re *grep_re_get(const char *pat, int cflags)
+{
+  grep_re *victim = NULL;
+  for (int i = 0; i < GREP_RE_CACHE; i++) {
+    grep_re *r = &g_grep_re[i];
+    if (r->pat && r->cflags == cflags && strcmp(r->pat, pat) == 0) {
+      r->refs++;
+      r->last_use = ++g_grep_re_clock;
+      g_grep_re_hits++;
+      return r;
+    }
+    if (r->refs == 0 && (!victim || !r->pat || (victim->pat && r->last_use < victim->last_use)))
+      victim = r;
+  }
+  if (!victim) return NULL;
+
+  g_grep_re_misses++;
+  if (victim->pat) {
+    regfree(&victim->re);
+    free(victim->pat);
+    victim->pat = NULL;
+  }
+  if (regcomp(&victim->re, pat, cflags) != 0) return NULL;
+  victim->pat = strdup(pat);
+  if (!victim->pat) { regfree(&victim->re); return NULL; }
+  victim->cflags = cflags;
+  victim->refs = 1;
+  victim->last_use = ++g_grep_re_clock;
+  return victim;
+}
+
+static void grep_cleanup(native_stage *st)
+{
+  grep_opts *g = st->ctx;
+  if (!g) return;
+  if (g->re) g->re->refs--;
+  if (g->own_re) { regfree(g->own_re); free(g->own_re); }
+  g->re = NULL;
+  g->own_re = NULL;
+}
+
+// Case-insensitive search for the lowercased needle `fold`.
+static const char *find_icase(const char *h, size_t n, const char *fold, size_t m)
+{
+  if (m == 0) return h;
+  if (n < m) return NULL;
+  unsigned char lo = (unsigned char)fold[0];
+  unsigned char up = (unsigned char)toupper(lo);
+  const char *end = h + n - m + 1;   // last possible start + 1
+  const char *p = h;
+#ifdef HAVE_X86_SIMD
+  __m128i vlo = _mm_set1_epi8((char)lo), vup = _mm_set1_epi8((char)up);
+  while (end - p >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    unsigned mask = (unsigned)_mm_movemask_epi8(
+      _mm_or_si128(_mm_cmpeq_epi8(v, vlo), _mm_cmpeq_epi8(v, vup)));
+    while (mask) {
+      const char *c = p + __builtin_ctz(mask);
+      if (strncasecmp(c, fold, m) == 0) return c;
+      mask &= mask - 1;
+    }
+    p += 16;
+  }
+#endif
+  for (; p < end; p++) {
+    unsigned char c = (unsigned char)*p;
+    if ((c == lo || c == up) && strncasecmp(p, fold, m) == 0) return p;
+  }
+  return NULL;
+}
+
+static int grep_line_matches(const grep_opts *g, const char *s, size_t n)
+{
+  if (g->literal) {
+    if (g->icase) return find_icase(s, n, g->fold, g->patlen) != NULL;
+    return memmem(s, n, g->pat, g->patlen) != NULL;
+  }
+  regmatch_t pm = { .rm_so = 0, .rm_eo = (regoff_t)n };
+  const regex_t *re = g->own_re ? g->own_re : &g->re->re;
+  return regexec(re, s, 1, &pm, REG_STARTEND) == 0;
+}
+
+static void grep_emit(out_buf *ob, const grep_opts *g, const char *name,
+                      unsigned long lno, const char *s, size_t n)
+{
+  char num[32];
+  if (g->multi) { ob_write(ob, name, strlen(name)); ob_write(ob, ":", 1); }
+  if (g->lineno) {
+    int k = snprintf(num, sizeof(num), "%lu:", lno);
+    ob_write(ob, num, (size_t)k);
+  }
+  ob_write(ob, s, n);
+  ob_write(ob, "\n", 1);
+}
+
+// Scan buf[0..len) made of '\n'-terminated lines (at EOF the last one
+// may be unterminated).
+static void grep_block(grep_opts *g, const char *name, const char *buf, size_t len)
+{
+  const char *p = buf, *end = buf + len;
+
+  // Literal: jump from match to match. The lines in between are the
+  // output for -v, otherwise only counted for -n.
+  if (g->literal) {
+    while (p < end) {
+      const char *m = g->icase ? find_icase(p, (size_t)(end - p), g->fold, g->patlen)
+                               : memmem(p, (size_t)(end - p), g->pat, g->patlen);
+      const char *ls = end;
+      if (m) for (ls = m; ls > p && ls[-1] != '\n'; ls--) {}
+      if (g->invert && !g->lineno && !g->multi && p < ls) {
+        // plain -v: the whole run of lines goes out as one block
+        unsigned long nl = 0;
+        for (const char *q = p; (q = memchr(q, '\n', (size_t)(ls - q))); q++) nl++;
+        int open_end = ls[-1] != '\n';   // unterminated last line at EOF
+        g->lno += nl + (unsigned long)open_end;
+        g->hits += nl + (unsigned long)open_end;
+        if (!g->count) {
+          ob_write(g->ob, p, (size_t)(ls - p));
+          if (open_end) ob_write(g->ob, "\n", 1);
+        }
+        p = ls;
+      } else if (g->invert) {
+        while (p < ls) {
+          const char *le = memchr(p, '\n', (size_t)(ls - p));
+          if (!le) le = ls;
+          g->lno++;
+          g->hits++;
+          if (!g->count) grep_emit(g->ob, g, name, g->lno, p, (size_t)(le - p));
+          p = le + 1;
+        }
+      } else if (g->lineno) {
+        for (const char *q = p; (q = memchr(q, '\n', (size_t)(ls - q))); q++) g->lno++;
+      }
+      if (!m) return;
+      const char *le = memchr(m, '\n', (size_t)(end - m));
+      if (!le) le = end;
+      g->lno++;
+      if (!g->invert) {
+        g->hits++;
+        if (!g->count) grep_emit(g->ob, g, name, g->lno, ls, (size_t)(le - ls));
+      }
+      p = (le < end) ? le + 1 : end;
+    }
+    return;
+  }
+
+  while (p < end) {
+    const char *le = memchr(p, '\n', (size_t)(end - p));
+    if (!le) le = end;
+    g->lno++;
+    if (grep_line_matches(g, p, (size_t)(le - p)) != g->invert) {
+      g->hits++;
+      if (!g->count) grep_emit(g->ob, g, name, g->lno, p, (size_t)(le - p));
+    }
+    p = (le < end) ? le + 1 : end;
+  }
+}
+
+static int grep_tail_add(grep_opts *g, const char *p, size_t n)
+{
+  if (g->tail_len + n > g->tail_cap) {
+    size_t cap = g->tail_cap ? g->tail_cap : 4096;
+    while (cap < g->tail_len + n) cap *= 2;
+    char *t = realloc(g->tail, cap);
+    if (!t) return ENOMEM;
+    g->tail = t;
+    g->tail_cap = cap;
+  }
+  memcpy(g->tail + g->tail_len, p, n);
+  g->tail_len += n;
+  return 0;
+}
+
+// Feed an arbitrary slice of input: whole lines are scanned where they
+// are, only a line split across slices is copied.
+static int grep_feed(grep_opts *g, const char *name, const char *p, size_t n)
+{
+  const char *end = p + n;
+  if (g->tail_len) {
+    const char *nl = memchr(p, '\n', n);
+    size_t take = nl ? (size_t)(nl - p) + 1 : n;
+    if (grep_tail_add(g, p, take)) return ENOMEM;
+    if (!nl) return 0;
+    grep_block(g, name, g->tail, g->tail_len);
+    g->tail_len = 0;
+    p += take;
+  }
+  const char *nl = memrchr(p, '\n', (size_t)(end - p));
+  if (nl) {
+    grep_block(g, name, p, (size_t)(nl - p) + 1);
+    p = nl + 1;
+  }
+  return (p < end) ? grep_tail_add(g, p, (size_t)(end - p)) : 0;
+}
+
+// End of one input: last unterminated line, then the -c line.
+static void grep_input_done(grep_opts *g, const char *name)
+{
+  if (g->tail_len) grep_block(g, name, g->tail, g->tail_len);
+  g->tail_len = 0;
+  if (g->count) {
+    char num[32];
+    if (g->multi) { ob_write(g->ob, name, strlen(name)); ob_write(g->ob, ":", 1); }
+    int k = snprintf(num, sizeof(num), "%lu\n", g->hits);
+    ob_write(g->ob, num, (size_t)k);
+  }
+}
+
+static int grep_open_out(native_stage *st, int fd_out)
+{
+  grep_opts *g = st->ctx;
+  g->ob = malloc(sizeof(out_buf));
+  if (!g->ob) return ENOMEM;
+  g->ob->fd = fd_out;
+  g->ob->next = st->next;
+  g->ob->err = 0;
+  g->ob->len = 0;
+  return 0;
+}
+
+static int grep_close(native_stage *st, int rc)
+{
+  grep_opts *g = st->ctx;
+  if (g->ob) {
+    ob_flush(g->ob);
+    if (g->ob->err == EPIPE) rc = 128 + SIGPIPE;
+    else if (g->ob->err) { fprintf(stderr, "grep: write error: %s\n", strerror(g->ob->err)); rc = 2; }
+  }
+  free(g->ob);
+  free(g->tail);
+  g->ob = NULL;
+  g->tail = NULL;
+  native_release(st);
+  return rc;
+}
+
+static int native_grep_run(native_stage *st, int fd_in, int fd_out)
+{
+  grep_opts *g = st->ctx;
+  char *buf = malloc(NATIVE_IO_CHUNK);
+  if (!buf || grep_open_out(st, fd_out)) {
+    free(buf);
+    return grep_close(st, 2);
+  }
+
+  int rc = 1;
+  for (int i = 0; i < st->nfds && !g->ob->err; i++) {
+    int fd = (st->fds[i] == -1) ? fd_in : st->fds[i];
+    const char *name = ((char **)(g + 1))[i];   // names follow the opts
+    int err = 0;
+
+    g->lno = g->hits = 0;
+    for (;;) {
+      if (g_interrupted) { err = EINTR; break; }
+      ssize_t n = read(fd, buf, NATIVE_IO_CHUNK);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        err = errno;
+        break;
+      }
+      if (n == 0) break;
+      if ((err = grep_feed(g, name, buf, (size_t)n)) != 0) break;
+      if (g->ob->err) break;
+    }
+
+    if (st->fds[i] >= 0) close(st->fds[i]);
+    st->fds[i] = -2;
+
+    if (err == EINTR) { rc = 128 + SIGINT; break; }
+    if (err) {
+      fprintf(stderr, "grep: %s: %s\n", name, strerror(err));
+      g->tail_len = 0;
+      rc = 2;
+      continue;
+    }
+    grep_input_done(g, name);
+    if (g->hits && rc == 1) rc = 0;
+  }
+  free(buf);
+  return grep_close(st, rc);
+}
+
+// Fused stdin: the upstream stage pushes its output here.
+static int native_grep_push(native_stage *st, const char *p, size_t n)
+{
+  grep_opts *g = st->ctx;
+  if (!g->ob && !g->err) g->err = grep_open_out(st, st->fd_out);
+  if (!g->err) g->err = grep_feed(g, "(standard input)", p, n);
+  return g->err || g->ob->err;
+}
+
+static int native_grep_finish(native_stage *st)
+{
+  grep_opts *g = st->ctx;
+  if (!g->ob && !g->err) g->err = grep_open_out(st, st->fd_out);
+  if (g->err) {
+    fprintf(stderr, "grep: (standard input): %s\n", strerror(g->err));
+    return grep_close(st, 2);
+  }
+  if (g_interrupted) return grep_close(st, 128 + SIGINT);
+  grep_input_done(g, "(standard input)");
+  return grep_close(st, g->hits ? 0 : 1);
+}
+
+static int native_grep_prepare(char **args, native_stage *st)
 {
-  const char *home = getenv("HOME");
-  const char *target = NULL;
-
-  if (!args[1] || strcmp(args[1], "~") == 0) {
-    target = (home && *home) ? home : "/";
-  } else if (args[1][0] == '~' && args[1][1] == '/') {
-    if (!home || !*home) {
-      fprintf(stderr, "trade: cd: HOME is not set\n");
-      return 1;
+  int icase = 0, invert = 0, count = 0, lineno = 0, fixed = 0, extended = 0;
+  int i = 1;
+  for (; args[i] && args[i][0] == '-' && args[i][1] != '\0'; i++) {
+    if (strcmp(args[i], "--") == 0) { i++; break; }
+    for (const char *f = args[i] + 1; *f; f++) {
+      switch (*f) {
+      case 'i': icase = 1; break;
+      case 'v': invert = 1; break;
+      case 'c': count = 1; break;
+      case 'n': lineno = 1; break;
+      case 'F': fixed = 1; extended = 0; break;
+      case 'E': extended = 1; fixed = 0; break;
+      default: return 0;   // anything else: real grep
+      }
     }
-    size_t len = strlen(home) + strlen(args[1]);
-    char *buf = malloc(len + 1);
-    if (!buf) { perror("trade: malloc"); return 1; }
-    strcpy(buf, home);
-    strcat(buf, args[1] + 1); // skip '~'
-    if (chdir(buf) != 0) {
-      fprintf(stderr, "trade: cd: %s: %s\n", buf, strerror(errno));
+  }
+  if (!args[i]) return 0;
+  const char *pat = args[i++];
+
+  int nfiles = 0;
+  while (args[i + nfiles]) nfiles++;
+
+  grep_opts *g = arena_calloc(&g_arena, 1, sizeof(grep_opts) + (size_t)(nfiles ? nfiles : 1) * sizeof(char *));
+  int *fds = arena_alloc(&g_arena, (size_t)(nfiles ? nfiles : 1) * sizeof(int));
+  if (!g || !fds) return 0;
+  char **names = (char **)(g + 1);
+
+  g->icase = icase; g->invert = invert; g->count = count; g->lineno = lineno;
+  g->fixed = fixed; g->extended = extended;
+  g->pat = pat;
+  g->patlen = strlen(pat);
+  g->multi = nfiles > 1;
+
+  const char *meta = extended ? ".[]*^$\\+?(){}|" : ".[]*^$\\";
+  g->literal = fixed || strpbrk(pat, meta) == NULL;
+  if (g->literal && icase) {
+    g->fold = arena_alloc(&g_arena, g->patlen + 1);
+    if (!g->fold) return 0;
+    for (size_t k = 0; k <= g->patlen; k++) g->fold[k] = (char)tolower((unsigned char)pat[k]);
+  }
+  if (!g->literal) {
+    int cflags = REG_NOSUB | (extended ? REG_EXTENDED : 0) | (icase ? REG_ICASE : 0);
+    g->re = grep_re_get(pat, cflags);
+    if (!g->re) {
+      g->own_re = malloc(sizeof(regex_t));
+      if (!g->own_re || regcomp(g->own_re, pat, cflags) != 0) {
+        // invalid pattern: let grep report it in its own words
+        free(g->own_re);
+        return 0;
+      }
     }
-    free(buf);
-    return 1;
+  }
+
+  if (nfiles == 0) {
+    fds[0] = -1;
+    names[0] = "(standard input)";
+    nfiles = 1;
   } else {
-    target = args[1];
+    for (int k = 0; k < nfiles; k++) {
+      names[k] = args[i + k];
+      if (strcmp(args[i + k], "-") == 0) { fds[k] = -1; names[k] = "(standard input)"; continue; }
+      fds[k] = open(args[i + k], O_RDONLY | O_CLOEXEC);
+      if (fds[k] < 0) {
+        while (--k >= 0) if (fds[k] >= 0) close(fds[k]);
+        native_stage tmp = { .ctx = g };
+        grep_cleanup(&tmp);
+        return 0;
+      }
+    }
   }
 
-  if (chdir(target) != 0) {
-    fprintf(stderr, "trade: cd: %s: %s\n", target, strerror(errno));
+  memset(st, 0, sizeof(*st));
+  st->run = native_grep_run;
+  st->args = args;
+  st->fds = fds;
+  st->nfds = nfiles;
+  st->ctx = g;
+  st->cleanup = grep_cleanup;
+  if (nfiles == 1 && fds[0] == -1) {
+    st->push = native_grep_push;
+    st->finish = native_grep_finish;
   }
   return 1;
 }
 
-static int sh_pwd(char **args)
+// This thread's use since *r0; maxrss is per process, so left out.
+static void thread_use_since(const struct rusage *r0, struct rusage *out)
 {
-  (void)args;
-  char *cwd = getcwd(NULL, 0);
-  if (!cwd) {
-    fprintf(stderr, "trade: pwd: %s\n", strerror(errno));
-    return 1;
-  }
-  puts(cwd);
-  free(cwd);
-  return 1;
+  struct rusage r1;
+  getrusage(RUSAGE_THREAD, &r1);
+  memset(out, 0, sizeof(*out));
+  timersub(&r1.ru_utime, &r0->ru_utime, &out->ru_utime);
+  timersub(&r1.ru_stime, &r0->ru_stime, &out->ru_stime);
+  out->ru_nvcsw = r1.ru_nvcsw - r0->ru_nvcsw;
+  out->ru_nivcsw = r1.ru_nivcsw - r0->ru_nivcsw;
+  out->ru_inblock = r1.ru_inblock - r0->ru_inblock;
+  out->ru_oublock = r1.ru_oublock - r0->ru_oublock;
 }
 
-static int sh_start(char **args)
+// Run a chain of fused native stages: the head reads its input and
+// pushes downstream, then every later stage sees end of input in order.
+static void *native_thread(void *arg)
 {
-  (void)args;
-  int rc;
-  if (g_use_sudo) {
-    char *const argv[] = {(char*)SUDO, (char*)SYSTEMCTL, "start", (char*)SERVICE_NAME, NULL};
-    rc = run_cmd_capture_rc(argv);
-  } else {
-    char *const argv[] = {(char*)SYSTEMCTL, "start", (char*)SERVICE_NAME, NULL};
-    rc = run_cmd_capture_rc(argv);
+  native_stage *head = arg;
+  struct rusage r0;
+  getrusage(RUSAGE_THREAD, &r0);
+  int os_tid = (int)syscall(SYS_gettid);
+  for (native_stage *st = head; st; st = st->next) st->os_tid = os_tid;
+  head->rc = head->run(head, head->fd_in, head->fd_out);
+  for (native_stage *st = head->next; st; st = st->next) st->rc = st->finish(st);
+  // Ctrl-C ends the whole chain, as SIGINT would a process pipeline
+  if (g_interrupted) {
+    for (native_stage *st = head; st; st = st->next) st->rc = 128 + SIGINT;
   }
-  if (rc == 0) puts("trade: started.");
-  else fprintf(stderr, "trade: start failed (rc=%d)\n", rc);
-  return 1;
+  thread_use_since(&r0, &head->ru);
+  for (native_stage *st = head; st; st = st->next) {
+    if (st->close_in) close(st->fd_in);
+    if (st->close_out) close(st->fd_out);
+  }
+  __atomic_store_n(&head->finished, 1, __ATOMIC_RELEASE);
+  if (head->done_fd >= 0) {
+    uint64_t one = 1;
+    (void)!write(head->done_fd, &one, sizeof(one));
+  }
+  return NULL;
 }
 
-static int sh_stop(char **args)
+// ====== exec argv builders ======
+// install VERSION -> [sudo] yum install -y ~/fx_autotrade-system-VERSION-2.el9.x86_64.rpm
+static cmd_kind build_install_argv(const cmd_entry *e, char **args, char ***argv_out)
 {
-  (void)args;
-  int rc;
-  if (g_use_sudo) {
-    char *const argv[] = {(char*)SUDO, (char*)SYSTEMCTL, "stop", (char*)SERVICE_NAME, NULL};
-    rc = run_cmd_capture_rc(argv);
-  } else {
-    char *const argv[] = {(char*)SYSTEMCTL, "stop", (char*)SERVICE_NAME, NULL};
-    rc = run_cmd_capture_rc(argv);
+  if (!args[1]) {
+    fprintf(stderr, "trade: install: version required\n");
+    return CMD_UNKNOWN;
   }
-  if (rc == 0) puts("trade: stopped.");
-  else fprintf(stderr, "trade: stop failed (rc=%d)\n", rc);
-  return 1;
-}
 
-static int sh_restart(char **args)
-{
-  (void)args;
-  int rc;
-  if (g_use_sudo) {
-    char *const argv[] = {(char*)SUDO, (char*)SYSTEMCTL, "restart", (char*)SERVICE_NAME, NULL};
-    rc = run_cmd_capture_rc(argv);
-  } else {
-    char *const argv[] = {(char*)SYSTEMCTL, "restart", (char*)SERVICE_NAME, NULL};
-    rc = run_cmd_capture_rc(argv);
+  const char *version = args[1];
+  const char *home = getenv("HOME");
+
+  if (!home) {
+    fprintf(stderr, "trade: install: HOME not set\n");
+    return CMD_UNKNOWN;
   }
-  if (rc == 0) puts("trade: restarted.");
-  else fprintf(stderr, "trade: restart failed (rc=%d)\n", rc);
-  return 1;
+
+  // RPMファイルパス生成
+  char *rpm_path = arena_alloc(&g_arena, 512);
+  if (!rpm_path) { perror("trade: arena"); return CMD_UNKNOWN; }
+  snprintf(rpm_path, 512,
+           "%s/fx_autotrade-system-%s-2.el9.x86_64.rpm",
+           home, version);
+
+  if (access(rpm_path, F_OK) != 0) {
+    fprintf(stderr, "trade: install: file not found: %s\n", rpm_path);
+    return CMD_UNKNOWN;
+  }
+
+  char *extra[] = {rpm_path, NULL};
+  *argv_out = cmd_build_argv(e, extra);
+  return (*argv_out) ? CMD_EXEC_ALLOWED : CMD_UNKNOWN;
 }
 
-static int sh_status(char **args)
+// ====== command table ======
+#define BUILTIN(id, nm, fn) \
+  [id] = { .name = nm, .kind = CMD_PARENT_BUILTIN, .builtin = fn, .sudo = SUDO_NEVER }
+#define SERVICE(id, nm, fn, verb) \
+  [id] = { .name = nm, .kind = CMD_PARENT_BUILTIN, .builtin = fn, \
+           .prefix = {SYSTEMCTL, verb, SERVICE_NAME}, .sudo = SUDO_IF_AVAILABLE }
+#define EXEC(id, nm, pol, ...) \
+  [id] = { .name = nm, .kind = CMD_EXEC_ALLOWED, .prefix = {__VA_ARGS__}, .sudo = pol }
+#define EXEC_NATIVE(id, nm, pol, fn, ...) \
+  [id] = { .name = nm, .kind = CMD_EXEC_ALLOWED, .native = fn, \
+           .prefix = {__VA_ARGS__}, .sudo = pol }
+
+static const cmd_entry cmd_table[CMD_NCOMMANDS] = {
+  BUILTIN(CMD_HELP,         "help",         &sh_help),
+  BUILTIN(CMD_EXIT,         "exit",         &sh_exit),
+  BUILTIN(CMD_CD,           "cd",           &sh_cd),
+  BUILTIN(CMD_PWD,          "pwd",          &sh_pwd),
+  SERVICE(CMD_START,        "start",        &sh_start,   "start"),
+  SERVICE(CMD_STOP,         "stop",         &sh_stop,    "stop"),
+  SERVICE(CMD_RESTART,      "restart",      &sh_restart, "restart"),
+  SERVICE(CMD_STATUS,       "status",       &sh_status,  "status"),
+  BUILTIN(CMD_HEALTH,       "health",       &sh_health),
+  BUILTIN(CMD_MERGE_RPMNEW, "merge-rpmnew", &sh_merge_rpmnew),
+  BUILTIN(CMD_ARENA,        "arena",        &sh_arena),
+  BUILTIN(CMD_HASH,         "hash",         &sh_hash),
+  BUILTIN(CMD_SET,          "set",          &sh_set),
+  BUILTIN(CMD_STATS,        "stats",        &sh_stats),
+  BUILTIN(CMD_TRACE,        "trace",        &sh_trace),
+  BUILTIN(CMD_JOBS,         "jobs",         &sh_jobs),
+  BUILTIN(CMD_FG,           "fg",           &sh_fg),
+  BUILTIN(CMD_BG,           "bg",           &sh_bg),
+  BUILTIN(CMD_KILL,         "kill",         &sh_kill),
+
+  // log/update/install use sudo only when available; the rest always do.
+  EXEC(CMD_LOG,     "log",     SUDO_IF_AVAILABLE, PYTHON3, LOG_TOOL),
+  EXEC(CMD_CONFIG,  "config",  SUDO_ALWAYS,       PYTHON3, CONFIG_TOOL),
+  EXEC(CMD_BACKUP,  "backup",  SUDO_ALWAYS,       PYTHON3, BACKUP_TOOL),
+  EXEC(CMD_RESTORE, "restore", SUDO_ALWAYS,       PYTHON3, RESTORE_TOOL),
+  EXEC(CMD_NANO,    "nano",    SUDO_ALWAYS,       NANO),
+  EXEC(CMD_LS,      "ls",      SUDO_ALWAYS,       LS),
+  EXEC_NATIVE(CMD_CAT,  "cat",  SUDO_ALWAYS, native_cat_prepare, CAT),
+  EXEC_NATIVE(CMD_GREP, "grep", SUDO_ALWAYS, native_grep_prepare, GREP),
+  EXEC_NATIVE(CMD_SCAT, "scat", SUDO_ALWAYS, native_cat_prepare, CAT),
+  EXEC(CMD_UPDATE,  "update",  SUDO_IF_AVAILABLE, BASH, UPDATE_TOOL),
+  EXEC(CMD_SYNC,    "sync",    SUDO_ALWAYS,       SYNC),
+  [CMD_INSTALL] = { .name = "install", .kind = CMD_EXEC_ALLOWED, .build = build_install_argv,
+                    .prefix = {YUM, "install", "-y"}, .sudo = SUDO_IF_AVAILABLE },
+};
+
+#undef BUILTIN
+#undef SERVICE
+#undef EXEC
+#undef EXEC_NATIVE
+
+// Switch on length and then on the bytes that tell the names of that
+// length apart; the final strcmp against the table entry is the only
+// string compare. The switch is generated from cmd_table by
+// tools/gen_cmd_lookup.py, and src/Compile.sh refuses to build a stale one.
+static const cmd_entry *cmd_lookup(const char *name)
 {
-  (void)args;
-  int rc;
-  if (g_use_sudo) {
-    char *const argv[] = {(char*)SUDO, (char*)SYSTEMCTL, "status", (char*)SERVICE_NAME, NULL};
-    rc = run_cmd_capture_rc(argv);
-  } else {
-    char *const argv[] = {(char*)SYSTEMCTL, "status", (char*)SERVICE_NAME, NULL};
-    rc = run_cmd_capture_rc(argv);
+  int id = -1;
+  // BEGIN generated by tools/gen_cmd_lookup.py from cmd_table; do not edit
+  switch (strlen(name)) {
+  case 2:
+    switch (name[0]) {
+    case 'c': id = CMD_CD; break;
+    case 'f': id = CMD_FG; break;
+    case 'b': id = CMD_BG; break;
+    case 'l': id = CMD_LS; break;
+    }
+    break;
+  case 3:
+    switch (name[0]) {
+    case 'p': id = CMD_PWD; break;
+    case 's': id = CMD_SET; break;
+    case 'l': id = CMD_LOG; break;
+    case 'c': id = CMD_CAT; break;
+    }
+    break;
+  case 4:
+    switch (name[1]) {
+    case 'e': id = CMD_HELP; break;
+    case 'x': id = CMD_EXIT; break;
+    case 't': id = CMD_STOP; break;
+    case 'a':
+      switch (name[0]) {
+      case 'h': id = CMD_HASH; break;
+      case 'n': id = CMD_NANO; break;
+      }
+      break;
+    case 'o': id = CMD_JOBS; break;
+    case 'i': id = CMD_KILL; break;
+    case 'r': id = CMD_GREP; break;
+    case 'c': id = CMD_SCAT; break;
+    case 'y': id = CMD_SYNC; break;
+    }
+    break;
+  case 5:
+    switch (name[3]) {
+    case 'r': id = CMD_START; break;
+    case 'n': id = CMD_ARENA; break;
+    case 't': id = CMD_STATS; break;
+    case 'c': id = CMD_TRACE; break;
+    }
+    break;
+  case 6:
+    switch (name[0]) {
+    case 's': id = CMD_STATUS; break;
+    case 'h': id = CMD_HEALTH; break;
+    case 'c': id = CMD_CONFIG; break;
+    case 'b': id = CMD_BACKUP; break;
+    case 'u': id = CMD_UPDATE; break;
+    }
+    break;
+  case 7:
+    switch (name[6]) {
+    case 't': id = CMD_RESTART; break;
+    case 'e': id = CMD_RESTORE; break;
+    case 'l': id = CMD_INSTALL; break;
+    }
+    break;
+  case 12:
+    id = CMD_MERGE_RPMNEW; break;
   }
-  if (rc != 0) fprintf(stderr, "trade: status returned rc=%d\n", rc);
-  return 1;
+  // END generated
+
+  if (id < 0 || strcmp(name, cmd_table[id].name) != 0) return NULL;
+  return &cmd_table[id];
 }
 
-static int sh_health(char **args)
+// The first SUDO_IF_AVAILABLE command to need its prefix runs the sudo
+// probe, so a script that never needs sudo never pays for it.
+static const cmd_prefix *cmd_prefix_get(const cmd_entry *e)
 {
-  (void)args;
-  puts("=== HEALTH CHECK ===");
-
-  puts("[1/5] service status");
-  (void)sh_status(NULL);
+  cmd_prefix *p = &g_cmd_prefix[e - cmd_table];
+  if (p->argv) return p;
 
-  puts("\n[2/5] bot logs");
-  char *const lg[] = {(char*)PYTHON3, (char*)LOG_TOOL, NULL};
-  (void)run_cmd_capture_rc(lg);
+  int np = 0;
+  while (np < CMD_MAX_PREFIX && e->prefix[np]) np++;
+  if (np == 0) return p;
 
-  puts("\n[3/5] disk (df -h /)");
-  char *const df[] = {"df", "-h", "/", NULL};
-  (void)run_cmd_capture_rc(df);
+  if (e->sudo == SUDO_IF_AVAILABLE && g_use_sudo < 0) detect_sudo();
+  int use_sudo = (e->sudo == SUDO_ALWAYS) || (e->sudo == SUDO_IF_AVAILABLE && g_use_sudo);
 
-  puts("\n[4/5] memory (free -h)");
-  char *const fr[] = {"free", "-h", NULL};
-  (void)run_cmd_capture_rc(fr);
+  char **argv = calloc((size_t)(use_sudo + np + 1), sizeof(char*));
+  if (!argv) { perror("trade: calloc"); return NULL; }
 
-  puts("\n[5/5] time (date)");
-  char *const dt[] = {"date", NULL};
-  (void)run_cmd_capture_rc(dt);
+  int k = 0;
+  if (use_sudo) argv[k++] = (char*)SUDO;
+  for (int j = 0; j < np; j++) argv[k++] = (char*)e->prefix[j];
+  argv[k] = NULL;
 
-  puts("\n=== END HEALTH ===");
-  return 1;
+  p->argv = argv;
+  p->len = k;
+  return p;
 }
 
-// ====== builtin tables ======
-static char *builtin_str[] = {
-  "help",
-  "exit",
-  "cd",
-  "pwd",
-  "start",
-  "stop",
-  "restart",
-  "status",
-  "health",
-  "merge-rpmnew",
-};
+// prefix... extra... NULL, allocated from g_arena.
+static char **cmd_build_argv(const cmd_entry *e, char **extra)
+{
+  const cmd_prefix *p = cmd_prefix_get(e);
+  if (!p) return NULL;
 
-static int (*builtin_func[])(char **) = {
-  &sh_help,
-  &sh_exit,
-  &sh_cd,
-  &sh_pwd,
-  &sh_start,
-  &sh_stop,
-  &sh_restart,
-  &sh_status,
-  &sh_health,
-  &sh_merge_rpmnew,
-};
+  int ne = 0;
+  if (extra) while (extra[ne]) ne++;
 
-static int num_builtins(void)
-{
-  return (int)(sizeof(builtin_str) / sizeof(builtin_str[0]));
+  char **argv = arena_alloc(&g_arena, (size_t)(p->len + ne + 1) * sizeof(char*));
+  if (!argv) { perror("trade: arena"); return NULL; }
+
+  if (p->len) memcpy(argv, p->argv, (size_t)p->len * sizeof(char*));
+  if (ne) memcpy(argv + p->len, extra, (size_t)ne * sizeof(char*));
+  argv[p->len + ne] = NULL;
+  return argv;
 }
 
 // ====== quote-aware tokenizer ======
@@ -580,102 +4085,198 @@ static void sv_push(strvec *v, char *s)
 {
   if (v->len + 1 > v->cap) {
     int ncap = (v->cap == 0) ? 16 : (v->cap * 2);
-    char **tmp = realloc(v->items, (size_t)ncap * sizeof(char*));
-    if (!tmp) { perror("trade: realloc"); exit(1); }
+    char **tmp = arena_alloc(&g_arena, (size_t)ncap * sizeof(char*));
+    if (!tmp) { perror("trade: arena"); exit(1); }
+    if (v->len > 0) memcpy(tmp, v->items, (size_t)v->len * sizeof(char*));
     v->items = tmp;
     v->cap = ncap;
   }
   v->items[v->len++] = s;
 }
 
+// Tokens point into the line buffer and the vector lives in g_arena;
+// this only forgets the view.
 static void sv_free_all(strvec *v)
 {
-  for (int i = 0; i < v->len; i++) free(v->items[i]);
-  free(v->items);
   v->items = NULL; v->len = 0; v->cap = 0;
 }
 
-static char *sb_finish(char **buf, int *len, int *cap)
+// ====== delimiter scanning ======
+// The tokenizer only has to stop at a few bytes per state; everything in
+// between is copied as one span. scan_special() finds the next such byte
+// with SSE2/AVX2 where available and a lookup table otherwise.
+// The whitespace set must stay in sync with tokenize().
+enum { SCAN_NORMAL, SCAN_SQ, SCAN_DQ, SCAN_NSETS };
+
+static const char scan_sets[SCAN_NSETS][12] = {
+  [SCAN_NORMAL] = " \t\r\n'\"|&;\\",
+  [SCAN_SQ]     = "'",
+  [SCAN_DQ]     = "\"\\",
+};
+
+static unsigned char scan_tab[SCAN_NSETS][256];
+
+static const char *scan_scalar(const char *p, const char *end, int set)
 {
-  (void)cap;  // suppress unused-parameter warning
-  if (*len == 0) return NULL;
-  (*buf)[*len] = '\0';
-  char *out = strdup(*buf);
-  if (!out) { perror("trade: strdup"); exit(1); }
-  *len = 0;
-  return out;
+  const unsigned char *t = scan_tab[set];
+  while (p < end && !t[(unsigned char)*p]) p++;
+  return p;
+}
+
+#ifdef HAVE_X86_SIMD
+#define SCAN_SIMD_BODY(VEC, LOADU, SET1, CMPEQ, OR, MOVEMASK, W)              \
+  const char *s = scan_sets[set];                                            \
+  int n = (int)strlen(s);                                                    \
+  VEC nd[12];                                                                 \
+  for (int k = 0; k < n; k++) nd[k] = SET1(s[k]);                            \
+  while (end - p >= W) {                                                     \
+    VEC v = LOADU((const VEC *)p);                                           \
+    VEC m = CMPEQ(v, nd[0]);                                                 \
+    for (int k = 1; k < n; k++) m = OR(m, CMPEQ(v, nd[k]));                  \
+    unsigned mask = (unsigned)MOVEMASK(m);                                   \
+    if (mask) return p + __builtin_ctz(mask);                                \
+    p += W;                                                                  \
+  }                                                                          \
+  return scan_scalar(p, end, set);
+
+__attribute__((target("sse2")))
+static const char *scan_sse2(const char *p, const char *end, int set)
+{
+  SCAN_SIMD_BODY(__m128i, _mm_loadu_si128, _mm_set1_epi8, _mm_cmpeq_epi8,
+                 _mm_or_si128, _mm_movemask_epi8, 16)
+}
+
+__attribute__((target("avx2")))
+static const char *scan_avx2(const char *p, const char *end, int set)
+{
+  SCAN_SIMD_BODY(__m256i, _mm256_loadu_si256, _mm256_set1_epi8, _mm256_cmpeq_epi8,
+                 _mm256_or_si256, _mm256_movemask_epi8, 32)
+}
+#undef SCAN_SIMD_BODY
+#endif
+
+static const char *(*scan_wide)(const char *, const char *, int) = scan_scalar;
+
+// Short runs (typical arguments) are cheaper with the table than with
+// vector setup, so only hand over to the wide scanner after 16 bytes.
+static inline const char *scan_special(const char *p, const char *end, int set)
+{
+  const unsigned char *t = scan_tab[set];
+  const char *lim = (end - p > 16) ? p + 16 : end;
+  while (p < lim) {
+    if (t[(unsigned char)*p]) return p;
+    p++;
+  }
+  return (p < end) ? scan_wide(p, end, set) : p;
 }
 
-static void sb_add(char **buf, int *len, int *cap, char c)
+static void scan_init(void)
 {
-  if (*buf == NULL) {
-    *cap = 64;
-    *buf = malloc((size_t)(*cap));
-    if (!*buf) { perror("trade: malloc"); exit(1); }
-    *len = 0;
+  for (int set = 0; set < SCAN_NSETS; set++) {
+    for (const char *c = scan_sets[set]; *c; c++) scan_tab[set][(unsigned char)*c] = 1;
   }
-  if (*len + 2 >= *cap) {
-    *cap *= 2;
-    char *tmp = realloc(*buf, (size_t)(*cap));
-    if (!tmp) { perror("trade: realloc"); exit(1); }
-    *buf = tmp;
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    scan_wide = scan_avx2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    scan_wide = scan_sse2;
   }
-  (*buf)[(*len)++] = c;
+#endif
+}
+
+// Operator tokens are static and compared by pointer, so a quoted "&&"
+// or ";" stays an ordinary argument. The pipe keeps its old rule: any
+// token that is exactly "|", quoted or not, splits the pipeline.
+static char TOK_PIPE[] = "|";
+static char TOK_AMP[] = "&";
+static char TOK_SEMI[] = ";";
+static char TOK_AND[] = "&&";
+static char TOK_OR[] = "||";
+
+static int tok_is_pipe(const char *t) { return t == TOK_PIPE || (t[0] == '|' && t[1] == '\0'); }
+
+// Separators between the commands of a list.
+static int tok_is_sep(const char *t)
+{
+  return t == TOK_AMP || t == TOK_SEMI || t == TOK_AND || t == TOK_OR;
 }
 
-static strvec tokenize(const char *line, int *parse_err)
+// Tokenize `line` in place: quotes and escapes are collapsed by copying
+// bytes down, each token is NUL-terminated where it ends, and the strvec
+// points into `line`. The write cursor never passes the read cursor, so
+// one linear pass with no per-token allocation is enough.
+static strvec tokenize(char *line, int *parse_err)
 {
   *parse_err = 0;
   strvec out; sv_init(&out);
 
-  char *buf = NULL;
-  int blen = 0, bcap = 0;
+  char *w = line;      // write cursor
+  char *tok = NULL;    // start of the token being built (NULL: none yet)
+  char *end = line + strlen(line);
 
-  enum { ST_NORMAL, ST_SQ, ST_DQ } st = ST_NORMAL;
+#define TOK_ADD(ch)   do { if (!tok) tok = w; *w++ = (ch); } while (0)
+#define TOK_FINISH()  do { if (tok) { *w++ = '\0'; sv_push(&out, tok); tok = NULL; } } while (0)
 
-  for (size_t i = 0; line[i] != '\0'; i++) {
-    char c = line[i];
+  enum { ST_NORMAL = SCAN_NORMAL, ST_SQ = SCAN_SQ, ST_DQ = SCAN_DQ } st = ST_NORMAL;
+
+  for (char *r = line; r < end; r++) {
+    // copy the run of ordinary bytes up to the next delimiter in one go
+    char *q = (char *)scan_special(r, end, st);
+    if (q != r) {
+      if (!tok) tok = w;
+      if (w != r) memmove(w, r, (size_t)(q - r));
+      w += q - r;
+      r = q;
+      if (r == end) break;
+    }
+    char c = *r;
 
     if (st == ST_NORMAL) {
       if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
-        char *t = sb_finish(&buf, &blen, &bcap);
-        if (t) sv_push(&out, t);
+        TOK_FINISH();
         continue;
       }
       if (c == '\'') { st = ST_SQ; continue; }
       if (c == '"')  { st = ST_DQ; continue; }
 
-      if (c == '|') {
-        char *t = sb_finish(&buf, &blen, &bcap);
-        if (t) sv_push(&out, t);
-        sv_push(&out, strdup("|"));
+      if (c == '|' || c == '&' || c == ';') {
+        TOK_FINISH();
+        if (c == ';') {
+          sv_push(&out, TOK_SEMI);
+        } else if (r[1] == c) {
+          sv_push(&out, c == '|' ? TOK_OR : TOK_AND);
+          r++;
+        } else {
+          sv_push(&out, c == '|' ? TOK_PIPE : TOK_AMP);
+        }
         continue;
       }
 
       if (c == '\\') {
         // escape next char if exists
-        char n = line[i + 1];
-        if (n != '\0') { sb_add(&buf, &blen, &bcap, n); i++; continue; }
+        char n = r[1];
+        if (n != '\0') { TOK_ADD(n); r++; continue; }
         // trailing backslash -> treat as literal
-        sb_add(&buf, &blen, &bcap, c);
+        TOK_ADD(c);
         continue;
       }
 
-      sb_add(&buf, &blen, &bcap, c);
+      TOK_ADD(c);
     }
     else if (st == ST_SQ) {
       if (c == '\'') { st = ST_NORMAL; continue; }
-      sb_add(&buf, &blen, &bcap, c);
+      TOK_ADD(c);
     }
     else { // ST_DQ
       if (c == '"') { st = ST_NORMAL; continue; }
       if (c == '\\') {
-        char n = line[i + 1];
-        if (n != '\0') { sb_add(&buf, &blen, &bcap, n); i++; continue; }
-        sb_add(&buf, &blen, &bcap, c);
+        char n = r[1];
+        if (n != '\0') { TOK_ADD(n); r++; continue; }
+        TOK_ADD(c);
         continue;
       }
-      sb_add(&buf, &blen, &bcap, c);
+      TOK_ADD(c);
     }
   }
 
@@ -683,231 +4284,756 @@ static strvec tokenize(const char *line, int *parse_err)
     *parse_err = 1; // unclosed quote
   }
 
-  char *t = sb_finish(&buf, &blen, &bcap);
-  if (t) sv_push(&out, t);
+  if (tok) { *w = '\0'; sv_push(&out, tok); }
 
-  free(buf);
+#undef TOK_ADD
+#undef TOK_FINISH
   return out;
 }
 
-// ====== dispatch ======
-typedef enum {
-  CMD_PARENT_BUILTIN,   // help/exit/cd/pwd/start/stop...
-  CMD_EXEC_ALLOWED,     // can exec (and pipe)
-  CMD_UNKNOWN
-} cmd_kind;
-
-static cmd_kind classify_parent_builtin(const char *cmd)
+// ====== dispatch ======
+// Build exec argv for allowed exec-style commands.
+// `argv_out` is allocated from g_arena (released with the line).
+static cmd_kind build_exec_argv(const cmd_entry *e, char **args, char ***argv_out)
+{
+  *argv_out = NULL;
+  if (!e || e->kind != CMD_EXEC_ALLOWED) return CMD_UNKNOWN;
+
+  if (e->build) return e->build(e, args, argv_out);
+
+  *argv_out = cmd_build_argv(e, args + 1);
+  return (*argv_out) ? CMD_EXEC_ALLOWED : CMD_UNKNOWN;
+}
+
+// Convert a slice of tokens into args[] (NULL-terminated) without copying strings.
+// tokens are owned elsewhere; args array lives in g_arena.
+static char **tokens_to_args(char **tokens, int start, int end_exclusive)
+{
+  int n = end_exclusive - start;
+  if (n <= 0) return NULL;
+
+  char **args = arena_calloc(&g_arena, (size_t)n + 1, sizeof(char*));
+  if (!args) { perror("trade: arena"); return NULL; }
+  for (int i = 0; i < n; i++) args[i] = tokens[start + i];
+  args[n] = NULL;
+  return args;
+}
+
+// ====== pipeline executor ======
+// Stages are reaped in whatever order they finish: local children
+// through a pidfd each, zygote children through the zygote socket,
+// native chains through an eventfd their thread pokes. Single commands
+// with a deadline go through the same reaper as a one-stage pipeline.
+//
+// Spawned stages are stopped along one ladder: SIGPIPE, SIGTERM after
+// PIPE_TEARDOWN_MS, SIGKILL after KILL_GRACE_MS.
+// - teardown: when a stage fails, stages upstream of it that still run
+//   start at SIGPIPE (what their next write would raise anyway), so a
+//   producer does not keep burning CPU for a consumer that is gone;
+// - timeout: a stage past its deadline starts at SIGTERM and ends with
+//   rc 124, reported with its elapsed time.
+#define PIPE_TEARDOWN_MS 500
+#define KILL_GRACE_MS    2000
+
+static const int kill_ladder[] = { SIGPIPE, SIGTERM, SIGKILL };
+
+typedef struct {
+  pid_t pid;             // spawned stage; 0 for native, -1 if spawn failed
+  const char *name;
+  const cmd_entry *cmd;
+  long deadline_ns;      // CLOCK_MONOTONIC, 0 = none
+  long kill_at_ns;       // when to send kill_ladder[kill_level], 0 = not yet
+  int kill_level;
+  int timed_out;
+  int stopped;           // stop signal while stopped (job control), else 0
+  int done;
+  int rc;
+  long spawn_ns;         // for `trace`; 0 while tracing is off
+  long end_ns;
+  res_use use;
+} stage_wait;
+
+typedef struct {
+  int n;
+  stage_wait *st;
+  native_stage *nat;     // NULL when no stage is native
+  int left;
+  long start_ns;
+  pid_t pgid;            // foreground job's group: watch for stops
+  int stopped;           // returned because the job was suspended
+  int probes;            // unrelated commands (health): no teardown, no timeout report
+} pipe_wait;
+
+static int pw_native(const pipe_wait *w, int i) { return w->nat && w->nat[i].run; }
+
+static void pw_done(pipe_wait *w, int i, int rc, const struct rusage *ru)
+{
+  stage_wait *s = &w->st[i];
+  if (s->done) return;
+  s->done = 1;
+  s->rc = s->timed_out ? 124 : rc;
+  s->end_ns = mono_ns();
+  if (ru) {
+    res_add(&s->use, ru);
+    res_add(&g_line_use, ru);
+  }
+  w->left--;
+  if (w->probes) return;
+  if (s->timed_out) {
+    fprintf(stderr, "trade: %s timed out after %.1fs", s->name,
+            (double)(s->deadline_ns - w->start_ns) / 1e9);
+    if (s->kill_level == 2 && !s->kill_at_ns)
+      fprintf(stderr, " (ignored SIGTERM, killed at %.1fs)", (double)(mono_ns() - w->start_ns) / 1e9);
+    fputc('\n', stderr);
+  }
+  if (s->rc == 0) return;
+
+  for (int j = 0; j < i; j++) {
+    stage_wait *u = &w->st[j];
+    if (!u->done && u->pid > 0 && !u->kill_at_ns && u->kill_level == 0) u->kill_at_ns = mono_ns();
+  }
+}
+
+// Send whatever signals are due; returns the time of the next one
+// (0 = nothing scheduled).
+static long pw_tick(pipe_wait *w)
+{
+  long now = mono_ns(), next = 0;
+  for (int i = 0; i < w->n; i++) {
+    stage_wait *s = &w->st[i];
+    if (s->done || s->pid <= 0) continue;
+    if (s->deadline_ns && !s->timed_out && now >= s->deadline_ns) {
+      s->timed_out = 1;
+      if (s->kill_level < 1) s->kill_level = 1;
+      s->kill_at_ns = now;
+    }
+    if (s->kill_at_ns && now >= s->kill_at_ns) {
+      proc_kill(s->pid, kill_ladder[s->kill_level]);
+      if (s->kill_level < 2) {
+        s->kill_at_ns = now + (s->kill_level == 0 ? PIPE_TEARDOWN_MS : KILL_GRACE_MS) * 1000000L;
+        s->kill_level++;
+      } else {
+        s->kill_at_ns = 0;
+      }
+    }
+    if (s->kill_at_ns && (!next || s->kill_at_ns < next)) next = s->kill_at_ns;
+    if (s->deadline_ns && !s->timed_out && (!next || s->deadline_ns < next)) next = s->deadline_ns;
+  }
+  return next;
+}
+
+// Join a native chain whose head is stage i; its members are i, i+1, ...
+static void pw_join(pipe_wait *w, int i)
+{
+  native_stage *head = &w->nat[i];
+  if (head->started) pthread_join(head->tid, NULL);
+  head->started = 0;
+  // the chain ran on one thread; its use is booked on the head
+  for (native_stage *st = head; st; st = st->next, i++)
+    pw_done(w, i, st->rc, st == head ? &head->ru : NULL);
+}
+
+// A foreground job is suspended once every stage still running has
+// stopped. A stage stopped for touching the terminal before it was
+// handed over (SIGTTIN/SIGTTOU) is resumed, and so is a job with native
+// stages, whose threads cannot stop.
+static int pw_suspended(pipe_wait *w)
+{
+  int any = 0, nat = 0;
+  for (int i = 0; i < w->n; i++) {
+    stage_wait *s = &w->st[i];
+    if (s->done) continue;
+    if (pw_native(w, i)) { nat = 1; continue; }
+    if (s->stopped == SIGTTIN || s->stopped == SIGTTOU) {
+      s->stopped = 0;
+      kill(s->pid, SIGCONT);
+    }
+    if (!s->stopped) return 0;
+    any = 1;
+  }
+  if (!any) return 0;
+  if (nat) {
+    fprintf(stderr, "trade: a pipeline with built-in stages cannot be suspended\n");
+    for (int i = 0; i < w->n; i++) w->st[i].stopped = 0;
+    kill(-w->pgid, SIGCONT);
+    return 0;
+  }
+  w->stopped = 1;
+  return 1;
+}
+
+// Fallback when something cannot be watched: wait in stage order,
+// without deadlines.
+static void pw_wait_in_order(pipe_wait *w)
+{
+  for (int i = 0; i < w->n; i++) {
+    if (w->st[i].done) continue;
+    if (pw_native(w, i)) {
+      pw_join(w, i);
+    } else {
+      struct rusage ru;
+      int rc = proc_wait(w->st[i].pid, &ru);
+      pw_done(w, i, rc, &ru);
+    }
+  }
+}
+
+static void pipeline_wait(pipe_wait *w, int efd)
+{
+  const uint64_t tag_zygote = (uint64_t)w->n, tag_native = tag_zygote + 1, tag_chld = tag_zygote + 2,
+                 tag_priv = tag_zygote + 3;
+  int jc = g_jc && w->pgid > 0;
+  int *pidfds = arena_alloc(&g_arena, (size_t)w->n * sizeof(int));
+  int ep = epoll_create1(EPOLL_CLOEXEC);
+  int ok = pidfds && ep >= 0;
+  int zygote = 0, priv = 0, intr_sent = 0;
+
+  for (int i = 0; i < w->n && pidfds; i++) pidfds[i] = -1;
+  for (int i = 0; i < w->n && ok; i++) {
+    if (w->st[i].done || pw_native(w, i)) continue;
+    zy_child *c = zy_find(w->st[i].pid);
+    if (c) {
+      if (c->ch->priv) priv = 1;
+      else zygote = 1;
+      continue;
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = (uint64_t)i };
+    pidfds[i] = pidfd_open_pid(w->st[i].pid);
+    ok = pidfds[i] >= 0 && epoll_ctl(ep, EPOLL_CTL_ADD, pidfds[i], &ev) == 0;
+  }
+  if (ok && zygote && g_zy.fd >= 0) {
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = tag_zygote };
+    ok = epoll_ctl(ep, EPOLL_CTL_ADD, g_zy.fd, &ev) == 0;
+  }
+  if (ok && priv && g_priv.fd >= 0) {
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = tag_priv };
+    ok = epoll_ctl(ep, EPOLL_CTL_ADD, g_priv.fd, &ev) == 0;
+  }
+  if (ok && efd >= 0) {
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = tag_native };
+    ok = epoll_ctl(ep, EPOLL_CTL_ADD, efd, &ev) == 0;
+  }
+  // a pidfd only reports exit; stops show up as SIGCHLD
+  if (ok && jc && g_chld_pipe[0] >= 0) {
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = tag_chld };
+    ok = epoll_ctl(ep, EPOLL_CTL_ADD, g_chld_pipe[0], &ev) == 0;
+  }
+
+  while (ok && w->left > 0) {
+    long next = pw_tick(w);
+    int timeout = -1;
+    if (next) {
+      long ms = (next - mono_ns() + 999999L) / 1000000L;
+      timeout = ms > 0 ? (int)ms : 0;
+    }
+    struct epoll_event evs[8];
+    int n = epoll_wait(ep, evs, 8, timeout);
+    if (n < 0) {
+      if (errno != EINTR) break;
+      // the helper's children and probes never have the terminal: pass
+      // Ctrl-C on
+      if ((priv || w->probes) && g_interrupted && !intr_sent) {
+        intr_sent = 1;
+        for (int i = 0; i < w->n; i++) {
+          stage_wait *s = &w->st[i];
+          if (!s->done && s->pid > 0 && (w->probes || zy_is_priv(s->pid))) proc_kill(-s->pid, SIGINT);
+        }
+      }
+      continue;
+    }
+
+    for (int k = 0; k < n; k++) {
+      uint64_t tag = evs[k].data.u64;
+      if (tag < tag_zygote) {
+        int i = (int)tag, status;
+        struct rusage ru;
+        if (wait4(w->st[i].pid, &status, WNOHANG, &ru) != w->st[i].pid) continue;
+        close(pidfds[i]);
+        pidfds[i] = -1;
+        pw_done(w, i, status_to_rc(status), &ru);
+      } else if (tag == tag_zygote || tag == tag_priv) {
+        zy_msg m;
+        (void)zy_read(tag == tag_priv ? &g_priv : &g_zy, &m);   // on EOF every child is marked failed
+        for (int i = 0; i < w->n; i++) {
+          zy_child *c = w->st[i].done || pw_native(w, i) ? NULL : zy_find(w->st[i].pid);
+          if (!c) continue;
+          w->st[i].stopped = c->stopped;
+          if (!c->done) continue;
+          c->pid = 0;
+          pw_done(w, i, status_to_rc(c->status), &c->ru);
+        }
+      } else if (tag == tag_chld) {
+        char b[64];
+        while (read(g_chld_pipe[0], b, sizeof(b)) > 0) {}
+        for (int i = 0; i < w->n; i++) {
+          stage_wait *s = &w->st[i];
+          int status;
+          struct rusage ru;
+          if (s->done || pidfds[i] < 0) continue;
+          if (wait4(s->pid, &status, WNOHANG | WUNTRACED | WCONTINUED, &ru) != s->pid) continue;
+          if (WIFSTOPPED(status)) {
+            s->stopped = WSTOPSIG(status);
+          } else if (WIFCONTINUED(status)) {
+            s->stopped = 0;
+          } else {
+            close(pidfds[i]);
+            pidfds[i] = -1;
+            pw_done(w, i, status_to_rc(status), &ru);
+          }
+        }
+      } else {
+        uint64_t cnt;
+        (void)!read(efd, &cnt, sizeof(cnt));
+        for (int i = 0; i < w->n; i++) {
+          if (w->nat[i].started && __atomic_load_n(&w->nat[i].finished, __ATOMIC_ACQUIRE))
+            pw_join(w, i);
+        }
+      }
+    }
+    if (jc && w->left > 0 && pw_suspended(w)) break;
+  }
+
+  for (int i = 0; i < w->n && pidfds; i++) if (pidfds[i] >= 0) close(pidfds[i]);
+  if (ep >= 0) close(ep);
+  if (!w->stopped) pw_wait_in_order(w);
+}
+
+// ====== job control ======
+// A line ending in `&` starts a background job, and a foreground command
+// stopped with Ctrl-Z becomes one; `jobs`, `fg`, `bg` and `kill %n`
+// manage them. Each job is one process group. With job control on, the
+// foreground group owns the terminal until it ends or stops, and the
+// shell ignores the job control signals itself; SIGINT only sets
+// g_interrupted, which the native commands check between chunks.
+// Background jobs are reaped after SIGCHLD (or a zygote report) and
+// reported before the next prompt.
+#define MAX_JOBS 16
+
+typedef struct {
+  int id;                 // %id; 0 = free slot
+  pid_t pgid;
+  int n;
+  stage_wait *st;         // the job's stages (malloc)
+  int stopped;
+  int has_tmodes;
+  struct termios tmodes;  // terminal modes the job stopped with
+  char cmd[256];
+} job;
+
+static job g_jobs[MAX_JOBS];
+static pid_t g_shell_pgid;
+static struct termios g_shell_tmodes;
+static char **g_line_words;     // the command being run, for job listings
+static int g_line_nwords;
+
+static void on_sigchld(int sig)
+{
+  (void)sig;
+  int e = errno;
+  g_child_event = 1;
+  if (g_chld_pipe[1] >= 0) (void)!write(g_chld_pipe[1], "", 1);
+  errno = e;
+}
+
+static void on_sigint(int sig)
+{
+  (void)sig;
+  g_interrupted = 1;
+}
+
+static void jobs_init(int interactive)
+{
+  if (pipe2(g_chld_pipe, O_NONBLOCK | O_CLOEXEC) != 0) g_chld_pipe[0] = g_chld_pipe[1] = -1;
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  sa.sa_handler = on_sigchld;
+  sigaction(SIGCHLD, &sa, NULL);
+
+  if (!interactive || !isatty(STDIN_FILENO)) return;
+  // started in the background: wait until brought to the foreground
+  pid_t pg;
+  while (tcgetpgrp(STDIN_FILENO) != (pg = getpgrp())) kill(-pg, SIGTTIN);
+
+  sa.sa_handler = on_sigint;
+  sigaction(SIGINT, &sa, NULL);
+  signal(SIGQUIT, SIG_IGN);
+  signal(SIGTSTP, SIG_IGN);
+  signal(SIGTTIN, SIG_IGN);
+  signal(SIGTTOU, SIG_IGN);
+
+  (void)setpgid(0, 0);   // fails harmlessly for a session leader
+  g_shell_pgid = getpgrp();
+  if (tcsetpgrp(STDIN_FILENO, g_shell_pgid) != 0) return;
+  tcgetattr(STDIN_FILENO, &g_shell_tmodes);
+  g_jc = 1;
+}
+
+// Hand the terminal to a foreground group; a resumed job gets back the
+// terminal modes it stopped with.
+static void tty_give(pid_t pgid, const job *j)
+{
+  if (!g_jc || pgid <= 0) return;
+  tcsetpgrp(STDIN_FILENO, pgid);
+  if (j && j->has_tmodes) tcsetattr(STDIN_FILENO, TCSADRAIN, &j->tmodes);
+}
+
+// Take the terminal back; `j` is a job that just stopped.
+static void tty_take(job *j)
+{
+  if (!g_jc) return;
+  tcsetpgrp(STDIN_FILENO, g_shell_pgid);
+  if (j) j->has_tmodes = tcgetattr(STDIN_FILENO, &j->tmodes) == 0;
+  tcsetattr(STDIN_FILENO, TCSADRAIN, &g_shell_tmodes);
+}
+
+// The stages of `w` become a job; NULL when the table is full.
+static job *job_add(const pipe_wait *w, int stopped)
+{
+  job *j = NULL;
+  int id = 0;
+  for (int i = 0; i < MAX_JOBS; i++) {
+    if (!g_jobs[i].id) { if (!j) j = &g_jobs[i]; }
+    else if (g_jobs[i].id > id) id = g_jobs[i].id;
+  }
+  if (!j || !(j->st = malloc((size_t)w->n * sizeof(stage_wait)))) return NULL;
+
+  memcpy(j->st, w->st, (size_t)w->n * sizeof(stage_wait));
+  join_words(j->cmd, sizeof(j->cmd), g_line_words, g_line_nwords);
+  for (int i = 0; i < w->n; i++) {
+    // jobs have no deadlines; names in the line arena go away
+    stage_wait *s = &j->st[i];
+    s->name = j->cmd;
+    s->deadline_ns = s->kill_at_ns = 0;
+    s->kill_level = 0;
+  }
+  j->id = id + 1;
+  j->pgid = w->pgid;
+  j->n = w->n;
+  j->stopped = stopped;
+  j->has_tmodes = 0;
+  return j;
+}
+
+// Signal a job: its process group (0 = none, when every stage is run
+// by the root helper) and the helper's stages, each in a session of its
+// own. -1 with errno when nothing could be signalled.
+static int job_kill(pid_t pgid, const stage_wait *st, int n, int sig)
+{
+  int ok = 0, err = ESRCH;
+  if (pgid > 0) {
+    if (kill(-pgid, sig) == 0) ok = 1;
+    else err = errno;
+  }
+  for (int i = 0; i < n; i++) {
+    if (st[i].done || !zy_is_priv(st[i].pid)) continue;
+    if (proc_kill(-st[i].pid, sig) == 0) ok = 1;
+    else err = errno;
+  }
+  if (!ok) errno = err;
+  return ok ? 0 : -1;
+}
+
+static void job_free(job *j)
+{
+  free(j->st);
+  j->st = NULL;
+  j->id = 0;
+}
+
+static int job_rc(const job *j)
+{
+  int rc = j->st[j->n - 1].rc;
+  if (g_opt.pipefail) {
+    for (int i = j->n - 1; i >= 0; i--) {
+      if (j->st[i].rc != 0) return j->st[i].rc;
+    }
+  }
+  return rc;
+}
+
+// The job `%n` / `n` names, or the most recent one.
+static job *job_find(const char *arg, const char *who)
+{
+  job *best = NULL;
+  long id = -1;
+  if (arg) {
+    char *end;
+    id = strtol(arg + (arg[0] == '%'), &end, 10);
+    if (*end || id <= 0) {
+      fprintf(stderr, "trade: %s: %s: not a job (use %%N)\n", who, arg);
+      return NULL;
+    }
+  }
+  for (int i = 0; i < MAX_JOBS; i++) {
+    job *j = &g_jobs[i];
+    if (!j->id) continue;
+    if (id > 0 ? j->id == id : (!best || j->id > best->id)) best = j;
+  }
+  if (!best) fprintf(stderr, "trade: %s: %s: no such job\n", who, arg ? arg : "current");
+  return best;
+}
+
+static int job_is_current(const job *j)
 {
-  for (int i = 0; i < num_builtins(); i++) {
-    if (strcmp(cmd, builtin_str[i]) == 0) return CMD_PARENT_BUILTIN;
+  for (int i = 0; i < MAX_JOBS; i++) {
+    if (g_jobs[i].id > j->id) return 0;
   }
-  return CMD_UNKNOWN;
+  return 1;
 }
 
-// Build exec argv for allowed exec-style commands.
-// `argv_out` must be freed by caller (free(argv_out) only, not strings).
-static cmd_kind build_exec_argv(char **args, char ***argv_out)
+static void job_print(const job *j, const char *state)
 {
-  *argv_out = NULL;
-  if (!args || !args[0]) return CMD_UNKNOWN;
+  printf("[%d]%c  %-22s %s%s\n", j->id, job_is_current(j) ? '+' : ' ', state, j->cmd,
+         j->stopped || strncmp(state, "Running", 7) ? "" : " &");
+}
 
-  // exec-style allowed commands:
-  // log/config/backup/restore -> python3 tool ...
-  // nano/ls/cat/grep -> direct
-  // scat -> sudo cat ...
-  // update -> (sudo) bash UPDATE_TOOL ...
-
-  if (strcmp(args[0], "log") == 0) {
-  int count = 0;
-  while (args[count] != NULL) count++;
-
-  // log [ARGS...] -> sudo python3 LOG_TOOL [ARGS...]
-  // argv: sudo, python3, LOG_TOOL, (count-1 args), NULL
-  // or if sudo not available: python3, LOG_TOOL, ...
-  int use_sudo = g_use_sudo ? 1 : 0;
-  int base = use_sudo ? 3 : 2; // [sudo python3 LOG_TOOL] or [python3 LOG_TOOL]
-
-  char **argv = calloc((size_t)(base + (count - 1) + 1), sizeof(char*));
-  if (!argv) { perror("trade: calloc"); return CMD_UNKNOWN; }
-
-  int i = 0;
-  if (use_sudo) argv[i++] = (char*)SUDO;
-  argv[i++] = (char*)PYTHON3;
-  argv[i++] = (char*)LOG_TOOL;
-
-  for (int j = 1; j < count; j++) argv[i++] = args[j];
-  argv[i] = NULL;
-
-  *argv_out = argv;
-  return CMD_EXEC_ALLOWED;
-}
-
-  if (strcmp(args[0], "config") == 0) {
-    build_passthrough_argv(args, PYTHON3, CONFIG_TOOL, argv_out);
-    return (*argv_out) ? CMD_EXEC_ALLOWED : CMD_UNKNOWN;
-  }
-  if (strcmp(args[0], "backup") == 0) {
-    build_passthrough_argv(args, PYTHON3, BACKUP_TOOL, argv_out);
-    return (*argv_out) ? CMD_EXEC_ALLOWED : CMD_UNKNOWN;
-  }
-  if (strcmp(args[0], "restore") == 0) {
-    build_passthrough_argv(args, PYTHON3, RESTORE_TOOL, argv_out);
-    return (*argv_out) ? CMD_EXEC_ALLOWED : CMD_UNKNOWN;
-  }
-
-  if (strcmp(args[0], "nano") == 0) {
-    build_passthrough_argv(args, NANO, NULL, argv_out);
-    return (*argv_out) ? CMD_EXEC_ALLOWED : CMD_UNKNOWN;
-  }
-  if (strcmp(args[0], "ls") == 0) {
-    build_passthrough_argv(args, LS, NULL, argv_out);
-    return (*argv_out) ? CMD_EXEC_ALLOWED : CMD_UNKNOWN;
-  }
-  if (strcmp(args[0], "cat") == 0) {
-    build_passthrough_argv(args, CAT, NULL, argv_out);
-    return (*argv_out) ? CMD_EXEC_ALLOWED : CMD_UNKNOWN;
-  }
-  if (strcmp(args[0], "grep") == 0) {
-    build_passthrough_argv(args, GREP, NULL, argv_out);
-    return (*argv_out) ? CMD_EXEC_ALLOWED : CMD_UNKNOWN;
-  }
-
-  if (strcmp(args[0], "scat") == 0) {
-    // scat [ARGS...] -> sudo cat [ARGS...]
-    int count = 0;
-    while (args[count] != NULL) count++;
-    char **argv = calloc((size_t)count + 2, sizeof(char*));
-    if (!argv) { perror("trade: calloc"); return CMD_UNKNOWN; }
-    int i = 0;
-    argv[i++] = (char*)SUDO;
-    argv[i++] = (char*)CAT;
-    for (int j = 1; j < count; j++) argv[i++] = args[j];
-    argv[i] = NULL;
-    *argv_out = argv;
-    return CMD_EXEC_ALLOWED;
-  }
-
-  if (strcmp(args[0], "update") == 0) {
-    // update [ARGS...] -> (sudo) bash UPDATE_TOOL [ARGS...]
-    int count = 0;
-    while (args[count] != NULL) count++;
-
-    int use_sudo = g_use_sudo ? 1 : 0; // prefer sudo when available
-    // argv: [sudo] bash UPDATE_TOOL + (count-1 args) + NULL
-    char **argv = calloc((size_t)(count + 3), sizeof(char*));
-    if (!argv) { perror("trade: calloc"); return CMD_UNKNOWN; }
-
-    int i = 0;
-    if (use_sudo) argv[i++] = (char*)SUDO;
-    argv[i++] = (char*)BASH;
-    argv[i++] = (char*)UPDATE_TOOL;
-    for (int j = 1; j < count; j++) argv[i++] = args[j];
-    argv[i] = NULL;
-
-    *argv_out = argv;
-    return CMD_EXEC_ALLOWED;
-  }
-  if (strcmp(args[0], "sync") == 0) {
-    build_passthrough_argv(args, SYNC, NULL, argv_out);
-    return (*argv_out) ? CMD_EXEC_ALLOWED : CMD_UNKNOWN;
+// Wait for a foreground job (w->pgid has the terminal) until it ends or
+// stops. A stopped job is entered in the table (or keeps `j`) and
+// returned; NULL once it has ended.
+static job *job_wait_fg(pipe_wait *w, int efd, job *j)
+{
+  for (;;) {
+    pipeline_wait(w, efd);
+    if (!w->stopped) {
+      tty_take(NULL);
+      return NULL;
+    }
+    if (j || (j = job_add(w, 1))) break;
+    // no room in the table: it cannot stay stopped
+    fprintf(stderr, "trade: too many jobs; resuming\n");
+    for (int i = 0; i < w->n; i++) w->st[i].stopped = 0;
+    w->stopped = 0;
+    kill(-w->pgid, SIGCONT);
   }
-  
-  if (strcmp(args[0], "install") == 0) {
-  if (!args[1]) {
-    fprintf(stderr, "trade: install: version required\n");
-    return CMD_UNKNOWN;
+  tty_take(j);
+  j->stopped = 1;
+  putchar('\n');
+  job_print(j, "Stopped");
+  return j;
+}
+
+// Collect what background jobs did since the last call and report it.
+static void jobs_reap(void)
+{
+  int any = 0;
+  for (int i = 0; i < MAX_JOBS; i++) any |= g_jobs[i].id != 0;
+  zy_chan *chans[] = { &g_zy, &g_priv };
+  for (int k = 0; k < 2 && any; k++) {
+    zy_chan *ch = chans[k];
+    struct pollfd pf = { .fd = ch->fd, .events = POLLIN };
+    while (ch->fd >= 0 && poll(&pf, 1, 0) > 0) {
+      zy_msg m;
+      if (!zy_read(ch, &m)) break;
+    }
   }
+  if (!g_child_event) return;
+  g_child_event = 0;
+  char b[64];
+  if (g_chld_pipe[0] >= 0) while (read(g_chld_pipe[0], b, sizeof(b)) > 0) {}
+
+  for (int k = 0; k < MAX_JOBS; k++) {
+    job *j = &g_jobs[k];
+    if (!j->id) continue;
+    int running = 0, stopped = 0;
+    for (int i = 0; i < j->n; i++) {
+      stage_wait *s = &j->st[i];
+      if (s->done) continue;
+      zy_child *c = zy_find(s->pid);
+      int status;
+      struct rusage ru;
+      if (c) {
+        if (c->done) {
+          c->pid = 0;
+          s->done = 1;
+          s->rc = status_to_rc(c->status);
+        } else {
+          s->stopped = c->stopped;
+        }
+      } else {
+        pid_t r = wait4(s->pid, &status, WNOHANG | WUNTRACED | WCONTINUED, &ru);
+        if (r == s->pid) {
+          if (WIFSTOPPED(status)) s->stopped = WSTOPSIG(status);
+          else if (WIFCONTINUED(status)) s->stopped = 0;
+          else { s->done = 1; s->rc = status_to_rc(status); }
+        } else if (r < 0 && errno == ECHILD) {
+          s->done = 1;
+          s->rc = 1;
+        }
+      }
+      if (!s->done) { if (s->stopped) stopped++; else running++; }
+    }
 
-  const char *version = args[1];
-  const char *home = getenv("HOME");
+    if (!running && !stopped) {
+      char state[32];
+      int rc = job_rc(j);
+      if (rc == 0) snprintf(state, sizeof(state), "Done");
+      else snprintf(state, sizeof(state), "Exit %d", rc);
+      job_print(j, state);
+      job_free(j);
+    } else if (j->stopped != !running) {
+      j->stopped = !running;
+      job_print(j, j->stopped ? "Stopped" : "Running");
+    }
+  }
+  fflush(stdout);
+}
 
-  if (!home) {
-    fprintf(stderr, "trade: install: HOME not set\n");
-    return CMD_UNKNOWN;
+static int sh_jobs(char **args)
+{
+  (void)args;
+  jobs_reap();
+  for (int i = 0; i < MAX_JOBS; i++) {
+    const job *j = &g_jobs[i];
+    if (j->id) job_print(j, j->stopped ? "Stopped" : "Running");
   }
+  return 0;
+}
 
-  // RPMファイルパス生成
-  char rpm_path[512];
-  snprintf(rpm_path, sizeof(rpm_path),
-           "%s/fx_autotrade-system-%s-2.el9.x86_64.rpm",
-           home, version);
+static int sh_fg(char **args)
+{
+  job *j = job_find(args[1], "fg");
+  if (!j) return 1;
+  puts(j->cmd);
+  fflush(stdout);
 
-  int use_sudo = g_use_sudo ? 1 : 0;
-  
-  if (access(rpm_path, F_OK) != 0) {
-  fprintf(stderr, "trade: install: file not found: %s\n", rpm_path);
-  return CMD_UNKNOWN;
-  }
-  
-  // argv構築
-  // [sudo] yum install ./file.rpm
-  int argc = 0;
-if (use_sudo) argc++;
-argc += 4; // yum install -y file
-argc += 1; // NULL
-
-char **argv = calloc(argc, sizeof(char*));
-  if (!argv) {
-    perror("trade: calloc");
-    return CMD_UNKNOWN;
+  pipe_wait w = { .n = j->n, .st = j->st, .start_ns = mono_ns(), .pgid = j->pgid };
+  for (int i = 0; i < j->n; i++) {
+    j->st[i].stopped = 0;
+    if (!j->st[i].done) w.left++;
   }
+  tty_give(j->pgid, j);
+  job_kill(j->pgid, j->st, j->n, SIGCONT);
+  j->stopped = 0;
+  if (job_wait_fg(&w, -1, j)) return 128 + SIGTSTP;
+  int rc = job_rc(j);
+  if (rc != 0) fprintf(stderr, "trade: command failed (rc=%d)\n", rc);
+  job_free(j);
+  return rc;
+}
 
-  int i = 0;
-  if (use_sudo) argv[i++] = (char*)SUDO;
+static int sh_bg(char **args)
+{
+  job *j = job_find(args[1], "bg");
+  if (!j) return 1;
+  if (!j->stopped) {
+    fprintf(stderr, "trade: bg: job %d already in background\n", j->id);
+    return 1;
+  }
+  for (int i = 0; i < j->n; i++) j->st[i].stopped = 0;
+  j->stopped = 0;
+  job_kill(j->pgid, j->st, j->n, SIGCONT);
+  job_print(j, "Running");
+  return 0;
+}
 
-  argv[i++] = "yum";
-  argv[i++] = "install";
-  argv[i++] = "-y";
-  argv[i++] = rpm_path;
-  argv[i] = NULL;
+static const struct { const char *name; int sig; } g_signames[] = {
+  { "HUP", SIGHUP }, { "INT", SIGINT }, { "QUIT", SIGQUIT }, { "KILL", SIGKILL },
+  { "USR1", SIGUSR1 }, { "USR2", SIGUSR2 }, { "TERM", SIGTERM },
+  { "CONT", SIGCONT }, { "STOP", SIGSTOP },
+};
 
-  *argv_out = argv;
-  return CMD_EXEC_ALLOWED;
+// kill [-SIGNAL] %N: signal a job's process group (default SIGTERM).
+static int sh_kill(char **args)
+{
+  int sig = SIGTERM;
+  char **a = args + 1;
+  if (*a && (*a)[0] == '-') {
+    const char *nm = *a + 1;
+    if (strncmp(nm, "SIG", 3) == 0) nm += 3;
+    char *end;
+    long v = strtol(nm, &end, 10);
+    sig = (*nm && !*end && v > 0 && v < NSIG) ? (int)v : 0;
+    for (size_t i = 0; !sig && i < sizeof(g_signames) / sizeof(g_signames[0]); i++) {
+      if (strcmp(nm, g_signames[i].name) == 0) sig = g_signames[i].sig;
+    }
+    if (!sig) {
+      fprintf(stderr, "trade: kill: %s: unknown signal\n", *a);
+      return 1;
+    }
+    a++;
+  }
+  if (!*a || (*a)[0] != '%' || a[1]) {
+    fprintf(stderr, "trade: usage: kill [-SIGNAL] %%N\n");
+    return 1;
+  }
+  job *j = job_find(*a, "kill");
+  if (!j) return 1;
+  if (job_kill(j->pgid, j->st, j->n, sig) != 0) {
+    fprintf(stderr, "trade: kill: %%%d: %s\n", j->id, strerror(errno));
+    return 1;
   }
+  // a stopped job only acts on most signals once it runs again
+  if (j->stopped && sig != SIGKILL && sig != SIGSTOP && sig != SIGCONT)
+    job_kill(j->pgid, j->st, j->n, SIGCONT);
+  return 0;
+}
 
-  return CMD_UNKNOWN;
+// Deadline for a command about to be spawned: the `timeout` prefix,
+// `set timeout`, and `set privtimeout` for sudo commands; 0 = none.
+static long cmd_deadline(char *const argv[])
+{
+  long d = g_cmd_deadline_ns;
+  long ms = g_opt.timeout_ms;
+  if (strcmp(argv[0], SUDO) == 0 && g_opt.privtimeout_ms && (!ms || g_opt.privtimeout_ms < ms))
+    ms = g_opt.privtimeout_ms;
+  if (ms) {
+    long t = mono_ns() + ms * 1000000L;
+    if (!d || t < d) d = t;
+  }
+  return d;
 }
 
-// Convert a slice of tokens into args[] (NULL-terminated) without copying strings.
-// tokens are owned elsewhere; args array must be freed by caller.
-static char **tokens_to_args(char **tokens, int start, int end_exclusive)
+static int proc_wait_timed(pid_t pid, char *const argv[])
 {
-  int n = end_exclusive - start;
-  if (n <= 0) return NULL;
+  if (pid <= 0) return 127;
+  long deadline = cmd_deadline(argv);
+  if (!deadline && !g_jc) {
+    struct rusage ru;
+    int rc = proc_wait(pid, &ru);
+    res_add(&g_line_use, &ru);
+    return rc;
+  }
 
-  char **args = calloc((size_t)n + 1, sizeof(char*));
-  if (!args) { perror("trade: calloc"); return NULL; }
-  for (int i = 0; i < n; i++) args[i] = tokens[start + i];
-  args[n] = NULL;
-  return args;
+  stage_wait st = {
+    .pid = pid, .deadline_ns = deadline,
+    .name = g_cmd_name ? g_cmd_name : (strcmp(argv[0], SUDO) == 0 && argv[1]) ? argv[1] : argv[0],
+  };
+  pid_t pgid = g_jc && !zy_is_priv(pid) ? pid : 0;
+  pipe_wait w = { .n = 1, .st = &st, .left = 1, .start_ns = mono_ns(), .pgid = pgid };
+  tty_give(pgid, NULL);
+  if (job_wait_fg(&w, -1, NULL)) return 128 + SIGTSTP;
+  return st.rc;
 }
 
-// ====== pipeline executor ======
-static int exec_pipeline(strvec *tokv)
+// `timed`: print a `time` line per stage. `bg`: start it as a job and
+// return without waiting.
+static int exec_pipeline(strvec *tokv, int timed, int bg)
 {
   int (*pipes)[2] = NULL;
   int npipes = 0;
-  pid_t *pids = NULL;
+  stage_wait *sw = NULL;
   char ***argvs = NULL;
+  native_stage *nat = NULL;
   int *starts = NULL;
   int *ends = NULL;
 
   // split by '|'
   int ncmd = 1;
   for (int i = 0; i < tokv->len; i++) {
-    if (strcmp(tokv->items[i], "|") == 0) ncmd++;
+    if (tok_is_pipe(tokv->items[i])) ncmd++;
   }
 
   // build command ranges
-  starts = calloc((size_t)ncmd, sizeof(int));
-  ends   = calloc((size_t)ncmd, sizeof(int));
-  if (!starts || !ends) { perror("trade: calloc"); free(starts); free(ends); return 1; }
+  starts = arena_calloc(&g_arena, (size_t)ncmd, sizeof(int));
+  ends   = arena_calloc(&g_arena, (size_t)ncmd, sizeof(int));
+  if (!starts || !ends) { perror("trade: arena"); return 1; }
 
   int ci = 0;
   int s = 0;
   for (int i = 0; i <= tokv->len; i++) {
-    if (i == tokv->len || strcmp(tokv->items[i], "|") == 0) {
+    if (i == tokv->len || tok_is_pipe(tokv->items[i])) {
       starts[ci] = s;
       ends[ci] = i;
       ci++;
@@ -916,40 +5042,53 @@ static int exec_pipeline(strvec *tokv)
   }
 
   // validate and build exec argv for each stage
-  argvs = calloc((size_t)ncmd, sizeof(char**));
-  if (!argvs) { perror("trade: calloc"); free(starts); free(ends); return 1; }
+  argvs = arena_calloc(&g_arena, (size_t)ncmd, sizeof(char**));
+  nat = arena_calloc(&g_arena, (size_t)ncmd, sizeof(native_stage));
+  sw = arena_calloc(&g_arena, (size_t)ncmd, sizeof(stage_wait));
+  if (!argvs || !nat || !sw) { perror("trade: arena"); return 1; }
 
   for (int k = 0; k < ncmd; k++) {
     char **args = tokens_to_args(tokv->items, starts[k], ends[k]);
     if (!args || !args[0]) {
       fprintf(stderr, "trade: invalid pipeline (empty command)\n");
-      free(args);
       goto fail;
     }
 
+    sw[k].name = args[0];
+
     // parent-only builtin is not allowed in pipeline
-    if (classify_parent_builtin(args[0]) == CMD_PARENT_BUILTIN) {
-      fprintf(stderr, "trade: '%s' cannot be used in a pipeline\n", args[0]);
-      free(args);
+    const cmd_entry *e = cmd_lookup(args[0]);
+    sw[k].cmd = e;
+    if (e && e->kind == CMD_PARENT_BUILTIN) {
+      fprintf(stderr, "trade: '%s' cannot be used %s\n", args[0],
+              bg ? "in the background" : "in a pipeline");
       goto fail;
     }
 
+    // native stages run on a thread and need no argv; a job is only
+    // processes, so it can be stopped and outlive the line
+    if (!bg && e && e->native && e->native(args, &nat[k])) continue;
+
     char **exec_argv = NULL;
-    if (build_exec_argv(args, &exec_argv) != CMD_EXEC_ALLOWED || !exec_argv) {
+    if (build_exec_argv(e, args, &exec_argv) != CMD_EXEC_ALLOWED || !exec_argv) {
       fprintf(stderr, "trade: command not allowed in pipeline: %s\n", args[0]);
-      free(args);
       goto fail;
     }
 
     argvs[k] = exec_argv;
-    free(args);
+  }
+
+  // a native stage that only reads stdin is fed by the native stage
+  // before it directly; no pipe between them
+  for (int k = 1; k < ncmd; k++) {
+    if (nat[k - 1].run && nat[k].push) nat[k - 1].next = &nat[k];
   }
 
   // create pipes
   if (ncmd > 1) {
     npipes = ncmd - 1;
-    pipes = calloc((size_t)npipes, sizeof(int[2]));
-    if (!pipes) { perror("trade: calloc"); goto fail; }
+    pipes = arena_calloc(&g_arena, (size_t)npipes, sizeof(int[2]));
+    if (!pipes) { perror("trade: arena"); goto fail; }
 
     // init to -1 so fail-path close is safe even if pipe() fails mid-way
     for (int i = 0; i < npipes; i++) {
@@ -958,43 +5097,83 @@ static int exec_pipeline(strvec *tokv)
     }
 
     for (int i = 0; i < npipes; i++) {
-      if (pipe(pipes[i]) != 0) {
+      if (nat[i].next) continue;
+      if (pipe2(pipes[i], O_CLOEXEC) != 0) {
         perror("trade: pipe");
         goto fail;
       }
+      // bigger pipes mean fewer wakeups per MB; a refusal (EPERM past the
+      // per-user limit) just leaves the default size
+      if (g_opt.pipe_size > 0) (void)fcntl(pipes[i][1], F_SETPIPE_SZ, (int)g_opt.pipe_size);
     }
   }
 
-  pids = calloc((size_t)ncmd, sizeof(pid_t));
-  if (!pids) { perror("trade: calloc"); goto fail; }
+  // native chains on a thread report back through this
+  int efd = -1;
+  for (int i = 0; i < ncmd && efd < 0; i++) {
+    if (nat[i].run) efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  }
+
+  trace_dispatched();
 
-  // fork each stage
+  // a background job without a terminal must not read the shell's input
+  int null_in = -1;
+  if (bg && !g_jc) null_in = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+  // start each stage; a stage that fails to start counts as rc 127.
+  // The first process leads the job's group, which gets the terminal;
+  // stages run by the root helper cannot join it.
+  long start_ns = mono_ns();
+  pid_t pgid = 0;
   for (int i = 0; i < ncmd; i++) {
-    pid_t pid = fork();
-    if (pid < 0) {
-      perror("trade: fork");
-      goto fail;
-    }
-    if (pid == 0) {
-      // child: wire stdin/stdout
-      if (pipes && npipes > 0) {
-        if (i > 0) {
-          dup2(pipes[i - 1][0], STDIN_FILENO);
-        }
-        if (i < ncmd - 1) {
-          dup2(pipes[i][1], STDOUT_FILENO);
-        }
-        // close all pipe fds
-        for (int j = 0; j < npipes; j++) {
-          if (pipes[j][0] != -1) close(pipes[j][0]);
-          if (pipes[j][1] != -1) close(pipes[j][1]);
+    int fd_in = (i > 0) ? pipes[i - 1][0] : -1;
+    int fd_out = (i < ncmd - 1) ? pipes[i][1] : -1;
+
+    if (nat[i].run) {
+      if (i > 0 && nat[i - 1].next) continue;   // driven by its chain head
+
+      // the chain owns its outer pipe ends and closes them when done
+      native_stage *head = &nat[i];
+      int j = i;
+      while (nat[j].next) j++;
+      native_stage *tail = &nat[j];
+      fd_out = (j < ncmd - 1) ? pipes[j][1] : -1;
+      head->fd_in = (fd_in >= 0) ? fd_in : STDIN_FILENO;
+      head->close_in = (fd_in >= 0);
+      tail->fd_out = (fd_out >= 0) ? fd_out : STDOUT_FILENO;
+      tail->close_out = (fd_out >= 0);
+      head->done_fd = efd;
+      if (i > 0) pipes[i - 1][0] = -1;
+      if (j < ncmd - 1) pipes[j][1] = -1;
+      if (j == ncmd - 1) fflush(stdout);
+      for (int k = i; k <= j; k++) sw[k].spawn_ns = trace_now();
+
+      if (i == 0 && j == ncmd - 1) {
+        native_thread(head);     // nothing external: run it right here
+      } else if (pthread_create(&head->tid, NULL, native_thread, head) != 0) {
+        fprintf(stderr, "trade: cannot start stage: %s\n", head->args[0]);
+        for (native_stage *st = head; st; st = st->next) {
+          native_release(st);
+          st->rc = 127;
         }
+        if (head->close_in) close(head->fd_in);
+        if (tail->close_out) close(tail->fd_out);
+      } else {
+        head->started = 1;
       }
-      execvp(argvs[i][0], argvs[i]);
-      fprintf(stderr, "trade: execvp failed: %s (%s)\n", argvs[i][0], strerror(errno));
-      _exit(127);
+      continue;
+    }
+
+    if (i == 0 && null_in >= 0) fd_in = null_in;
+    spawn_req r = { .argv = argvs[i], .fd_in = fd_in, .fd_out = fd_out, .fd_err = -1,
+                    .setpgrp = g_jc || bg, .pgid = pgid };
+    sw[i].pid = spawn_proc(&r);
+    sw[i].spawn_ns = trace_now();
+    if (r.setpgrp && !pgid && sw[i].pid > 0 && !zy_is_priv(sw[i].pid)) {
+      pgid = sw[i].pid;
+      if (!bg) tty_give(pgid, NULL);
     }
-    pids[i] = pid;
+    sw[i].deadline_ns = cmd_deadline(argvs[i]);
   }
 
   // parent: close pipes
@@ -1007,109 +5186,621 @@ static int exec_pipeline(strvec *tokv)
     }
   }
 
-  // wait
-  int last_rc = 0;
+  if (null_in >= 0) close(null_in);
+
+  // wait; stages that never started are already done
+  long wait_ns = trace_now();
+  pipe_wait w = { .n = ncmd, .st = sw, .nat = nat, .left = ncmd, .start_ns = start_ns,
+                  .pgid = g_jc ? pgid : 0 };
   for (int i = 0; i < ncmd; i++) {
-    int status = 0;
-    if (waitpid(pids[i], &status, 0) < 0) {
-      perror("trade: waitpid");
-      last_rc = 1;
-      continue;
+    if (nat[i].run && !nat[i].started && !(i > 0 && nat[i - 1].next)) pw_join(&w, i);
+    else if (!nat[i].run && sw[i].pid <= 0) pw_done(&w, i, 127, NULL);
+  }
+
+  if (bg) {
+    w.pgid = pgid;
+    job *j = w.left > 0 ? job_add(&w, 0) : NULL;
+    if (j) {
+      printf("[%d] %d\n", j->id, (int)(pgid ? pgid : sw[0].pid));
+      return 0;
     }
-    if (i == ncmd - 1) {
-      if (WIFEXITED(status)) last_rc = WEXITSTATUS(status);
-      else if (WIFSIGNALED(status)) last_rc = 128 + WTERMSIG(status);
-      else last_rc = 1;
+    if (w.left > 0) {
+      // nowhere to track it: better not to start it at all
+      fprintf(stderr, "trade: too many jobs\n");
+      job_kill(pgid, sw, ncmd, SIGKILL);
+      pw_wait_in_order(&w);
     }
+    return 1;
   }
 
-  // cleanup
-  free(pids);
-  if (pipes) free(pipes);
-  for (int i = 0; i < ncmd; i++) free(argvs[i]);
-  free(argvs);
-  free(starts);
-  free(ends);
+  int stopped = job_wait_fg(&w, efd, NULL) != NULL;
+  if (efd >= 0) close(efd);
+  trace_add("wait", wait_ns, trace_now(), 0, NULL);
+  for (int i = 0; i < ncmd; i++) {
+    int tid = nat[i].run ? nat[i].os_tid : sw[i].pid;
+    if (tid == (int)getpid()) tid = 0;   // ran inline
+    if (!sw[i].done) continue;
+    if (nat[i].run) trace_add("exec", sw[i].spawn_ns, sw[i].end_ns, tid, sw[i].name);
+    else if (tid > 0) trace_add_argv("exec", sw[i].spawn_ns, sw[i].end_ns, tid, argvs[i]);
+  }
 
-  (void)last_rc;
-  return 1;
+  int rc = sw[ncmd - 1].rc;
+  if (g_opt.pipefail) {
+    for (int i = ncmd - 1; i >= 0; i--) {
+      if (sw[i].rc != 0) { rc = sw[i].rc; break; }
+    }
+  }
+  if (stopped) rc = 128 + SIGTSTP;
+  if (rc != 0 && !stopped) fprintf(stderr, "trade: command failed (rc=%d)\n", rc);
+
+  for (int i = 0; i < ncmd; i++) {
+    if (!sw[i].done) continue;
+    stats_record(sw[i].cmd, sw[i].end_ns - start_ns, &sw[i].use);
+    if (timed) res_print(sw[i].name, sw[i].end_ns - start_ns, &sw[i].use);
+  }
+
+  // starts/ends/argvs/pipes/sw are released with the line arena
+  return rc;
 
 fail:
+  for (int i = 0; i < ncmd; i++) {
+    if (nat[i].run) native_release(&nat[i]);
+  }
   if (pipes && npipes > 0) {
     for (int j = 0; j < npipes; j++) {
       if (pipes[j][0] != -1) close(pipes[j][0]);
       if (pipes[j][1] != -1) close(pipes[j][1]);
     }
   }
-  if (pipes) free(pipes);
-  if (pids) free(pids);
-  if (argvs) {
-    for (int i = 0; i < ncmd; i++) free(argvs[i]);
-    free(argvs);
-  }
-  free(starts);
-  free(ends);
   return 1;
 }
 
+// ====== health ======
+// The probes run at the same time. Those the shell can answer itself run
+// in it: status from the cgroup or the bus, and disk, memory and clock
+// from statvfs, /proc and adjtimex, printed as df -h, free -h and date
+// would. The rest (the log tool, and systemctl when status cannot be
+// answered here) are spawned with stdout and stderr on a memfd per
+// probe and watched by pipeline_wait() as unrelated stages, each with
+// its own deadline. The reports then print in the fixed [1/5]..[5/5]
+// order with their durations, so `health` takes as long as its slowest
+// probe rather than the sum.
+#define HEALTH_PROBES 5
+
+static const char *const g_health_fs[] = { "/", "/tmp", "/opt/Innovations" };
+
+static double ceil_pos(double x)
+{
+  double t = (double)(unsigned long long)x;
+  return t < x ? t + 1.0 : t;
+}
+
+// df -h size: powers of 1024 rounded up, one decimal below 10.
+static const char *df_human(char *buf, size_t n, uint64_t v)
+{
+  static const char units[] = "KMGTPE";
+  if (v < 1024) {
+    snprintf(buf, n, "%llu", (unsigned long long)v);
+    return buf;
+  }
+  double d = (double)v;
+  int u = -1;
+  do { d /= 1024.0; u++; } while (d >= 1024.0 && u < 5);
+  double tenths = ceil_pos(d * 10.0) / 10.0;
+  if (tenths < 10.0) {
+    snprintf(buf, n, "%.1f%c", tenths, units[u]);
+  } else {
+    double whole = ceil_pos(d);
+    if (whole >= 1024.0 && u < 5) snprintf(buf, n, "1.0%c", units[u + 1]);
+    else snprintf(buf, n, "%.0f%c", whole, units[u]);
+  }
+  return buf;
+}
+
+// Source and mount point of the mount holding path (st_dev dev), from
+// mountinfo: the longest mount point that is a prefix of path.
+static void mount_of(const char *mi, const char *path, dev_t dev, char *src, char *mnt, size_t n)
+{
+  size_t best = 0;
+  snprintf(src, n, "-");
+  snprintf(mnt, n, "%s", path);
+  for (const char *l = mi; *l; ) {
+    const char *nl = strchr(l, '\n');
+    size_t ll = nl ? (size_t)(nl - l) : strlen(l);
+    char line[1024];
+    if (ll < sizeof(line)) {
+      memcpy(line, l, ll);
+      line[ll] = '\0';
+      // id parent maj:min root mountpoint opts ... - fstype source superopts
+      unsigned ma, mi_;
+      char point[512], fsrc[512];
+      const char *dash = strstr(line, " - ");
+      if (dash && sscanf(line, "%*d %*d %u:%u %*s %511s", &ma, &mi_, point) == 3 &&
+          sscanf(dash + 3, "%*s %511s", fsrc) == 1 && makedev(ma, mi_) == dev) {
+        // mountinfo escapes space, tab, newline and backslash as \ooo
+        char *w = point;
+        for (const char *r = point; *r; ) {
+          if (r[0] == '\\' && r[1] >= '0' && r[1] <= '3' && r[2] && r[3]) {
+            *w++ = (char)(((r[1] - '0') << 6) | ((r[2] - '0') << 3) | (r[3] - '0'));
+            r += 4;
+          } else {
+            *w++ = *r++;
+          }
+        }
+        *w = '\0';
+        size_t pl = strlen(point);
+        int prefix = strcmp(point, "/") == 0 ||
+                     (strncmp(path, point, pl) == 0 && (path[pl] == '/' || path[pl] == '\0'));
+        if (prefix && pl >= best) {
+          best = pl;
+          snprintf(src, n, "%s", fsrc);
+          snprintf(mnt, n, "%s", point);
+        }
+      }
+    }
+    if (!nl) break;
+    l = nl + 1;
+  }
+}
+
+// One pread of a /proc file kept open; the kernel regenerates it at 0.
+static ssize_t proc_pread(int *fd, const char *path, char *buf, size_t n)
+{
+  if (*fd < 0) *fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (*fd < 0) return -1;
+  ssize_t len = pread(*fd, buf, n - 1, 0);
+  if (len < 0) return -1;
+  buf[len] = '\0';
+  return len;
+}
+
+// All of a /proc file kept open, into *buf, grown as needed and kept for
+// the next call. Several preads: mountinfo runs past any fixed buffer on
+// hosts with many mounts, and a cut-off copy loses the late mounts.
+static ssize_t proc_pread_all(int *fd, const char *path, char **buf, size_t *cap)
+{
+  if (*fd < 0) *fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (*fd < 0) return -1;
+  size_t len = 0;
+  for (;;) {
+    if (*cap - len < 4096) {
+      size_t ncap = *cap ? *cap * 2 : 16384;
+      char *nb = realloc(*buf, ncap);
+      if (!nb) return -1;
+      *buf = nb;
+      *cap = ncap;
+    }
+    ssize_t r = pread(*fd, *buf + len, *cap - len - 1, (off_t)len);
+    if (r < 0 && errno == EINTR) continue;
+    if (r < 0) return -1;
+    if (r == 0) break;
+    len += (size_t)r;
+  }
+  (*buf)[len] = '\0';
+  return (ssize_t)len;
+}
+
+// df -h / /tmp /opt/Innovations. TRADE_MOUNTINFO replaces
+// /proc/self/mountinfo.
+static int hp_disk(int fd)
+{
+  static int mi_fd = -1;
+  static char *mi;
+  static size_t mi_cap;
+  const char *mi_path = getenv("TRADE_MOUNTINFO");
+  if (!mi_path || !*mi_path) mi_path = "/proc/self/mountinfo";
+  int rc = 0;
+  if (proc_pread_all(&mi_fd, mi_path, &mi, &mi_cap) < 0) {
+    // Filesystem and Mounted on below are guesses without it; say so
+    dprintf(fd, "df: %s: %s\n", mi_path, strerror(errno));
+    if (mi) mi[0] = '\0';
+    rc = 1;
+  }
+
+  enum { NFS = sizeof(g_health_fs) / sizeof(g_health_fs[0]) };
+  char col[NFS][4][16], src[NFS][512], mnt[NFS][512];
+  int ok[NFS];
+  int w_src = 14, w_num = 5, w_pct = 4;
+  for (int i = 0; i < NFS; i++) {
+    struct statvfs vfs;
+    struct stat sb;
+    ok[i] = stat(g_health_fs[i], &sb) == 0 && statvfs(g_health_fs[i], &vfs) == 0;
+    if (!ok[i]) {
+      dprintf(fd, "df: %s: %s\n", g_health_fs[i], strerror(errno));
+      rc = 1;
+      continue;
+    }
+    mount_of(mi ? mi : "", g_health_fs[i], sb.st_dev, src[i], mnt[i], sizeof(src[i]));
+    uint64_t f = vfs.f_frsize ? vfs.f_frsize : vfs.f_bsize;
+    uint64_t size = vfs.f_blocks * f, used = (vfs.f_blocks - vfs.f_bfree) * f, avail = vfs.f_bavail * f;
+    df_human(col[i][0], sizeof(col[i][0]), size);
+    df_human(col[i][1], sizeof(col[i][1]), used);
+    df_human(col[i][2], sizeof(col[i][2]), avail);
+    if (used + avail) snprintf(col[i][3], sizeof(col[i][3]), "%llu%%",
+                               (unsigned long long)((used * 100 + used + avail - 1) / (used + avail)));
+    else snprintf(col[i][3], sizeof(col[i][3]), "-");
+    if ((int)strlen(src[i]) > w_src) w_src = (int)strlen(src[i]);
+    for (int c = 0; c < 3; c++) if ((int)strlen(col[i][c]) > w_num) w_num = (int)strlen(col[i][c]);
+    if ((int)strlen(col[i][3]) > w_pct) w_pct = (int)strlen(col[i][3]);
+  }
+
+  // rows come after the errors, as df prints them
+  int rows = 0;
+  for (int i = 0; i < NFS; i++) rows += ok[i];
+  if (rows) dprintf(fd, "%-*s %*s %*s %*s %*s %s\n", w_src, "Filesystem", w_num, "Size",
+                    w_num, "Used", w_num, "Avail", w_pct, "Use%", "Mounted on");
+  for (int i = 0; i < NFS; i++) {
+    if (ok[i]) dprintf(fd, "%-*s %*s %*s %*s %*s %s\n", w_src, src[i], w_num, col[i][0],
+                       w_num, col[i][1], w_num, col[i][2], w_pct, col[i][3], mnt[i]);
+  }
+  return rc;
+}
+
+// free -h size: binary units, one decimal while that fits in 3 digits.
+static const char *free_human(char *buf, size_t n, uint64_t kb)
+{
+  static const char *const units[] = { "Ki", "Mi", "Gi", "Ti", "Pi" };
+  if (kb == 0) {
+    snprintf(buf, n, "0B");
+    return buf;
+  }
+  double v = (double)kb;
+  for (int u = 0; u < 5; u++, v /= 1024.0) {
+    if (snprintf(buf, n, "%.1f", v) <= 3 || snprintf(buf, n, "%ld", (long)v) <= 3 || u == 4) {
+      size_t l = strlen(buf);
+      snprintf(buf + l, n - l, "%s", units[u]);
+      return buf;
+    }
+  }
+  return buf;
+}
+
+static uint64_t meminfo_kb(const char *mi, const char *key)
+{
+  size_t kl = strlen(key);
+  for (const char *l = mi; l && *l; ) {
+    if (strncmp(l, key, kl) == 0 && l[kl] == ':') return strtoull(l + kl + 1, NULL, 10);
+    l = strchr(l, '\n');
+    if (l) l++;
+  }
+  return 0;
+}
+
+// free -h (used = total - free - buff/cache, as procps-ng 3.3 on OL8/9),
+// then the load average
+static int hp_memory(int fd)
+{
+  static int mi_fd = -1, la_fd = -1;
+  char mi[8192], la[128];
+  if (proc_pread(&mi_fd, "/proc/meminfo", mi, sizeof(mi)) <= 0) {
+    dprintf(fd, "free: /proc/meminfo: %s\n", strerror(errno));
+    return 1;
+  }
+  uint64_t total = meminfo_kb(mi, "MemTotal"), mfree = meminfo_kb(mi, "MemFree");
+  uint64_t cache = meminfo_kb(mi, "Buffers") + meminfo_kb(mi, "Cached") + meminfo_kb(mi, "SReclaimable");
+  uint64_t used = total > mfree + cache ? total - mfree - cache : total - mfree;
+  uint64_t stotal = meminfo_kb(mi, "SwapTotal"), sfree = meminfo_kb(mi, "SwapFree");
+  char b[6][16];
+  dprintf(fd, "%-8s %11s %11s %11s %11s %11s %11s\n", "", "total", "used", "free", "shared",
+          "buff/cache", "available");
+  dprintf(fd, "%-8s %11s %11s %11s %11s %11s %11s\n", "Mem:", free_human(b[0], 16, total),
+          free_human(b[1], 16, used), free_human(b[2], 16, mfree),
+          free_human(b[3], 16, meminfo_kb(mi, "Shmem")), free_human(b[4], 16, cache),
+          free_human(b[5], 16, meminfo_kb(mi, "MemAvailable")));
+  dprintf(fd, "%-8s %11s %11s %11s\n", "Swap:", free_human(b[0], 16, stotal),
+          free_human(b[1], 16, stotal - sfree), free_human(b[2], 16, sfree));
+
+  double l1, l5, l15;
+  if (proc_pread(&la_fd, "/proc/loadavg", la, sizeof(la)) > 0 && sscanf(la, "%lf %lf %lf", &l1, &l5, &l15) == 3)
+    dprintf(fd, "load average: %.2f, %.2f, %.2f\n", l1, l5, l15);
+  return 0;
+}
+
+// date, then whether the kernel clock is NTP-disciplined
+static int hp_clock(int fd)
+{
+  struct timespec ts;
+  struct tm tm;
+  char when[64];
+  clock_gettime(CLOCK_REALTIME, &ts);
+  localtime_r(&ts.tv_sec, &tm);
+  strftime(when, sizeof(when), "%a %b %e %H:%M:%S %Z %Y", &tm);
+  dprintf(fd, "%s\n", when);
+
+  struct timex tx;
+  memset(&tx, 0, sizeof(tx));
+  int state = adjtimex(&tx);
+  if (state < 0) {
+    dprintf(fd, "NTP: unknown (%s)\n", strerror(errno));
+  } else if (state == TIME_ERROR || (tx.status & STA_UNSYNC)) {
+    dprintf(fd, "NTP: not synchronized\n");
+  } else {
+    double off_ms = (double)tx.offset / ((tx.status & STA_NANO) ? 1e6 : 1e3);
+    dprintf(fd, "NTP: synchronized (offset %+.3fms, max error %.1fms)\n", off_ms, (double)tx.maxerror / 1e3);
+  }
+  return 0;
+}
+
+// status_native() with its output in fd.
+static int hp_status(int fd)
+{
+  fflush(stdout);
+  fflush(stderr);
+  int out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+  int err = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 10);
+  if (out < 0 || err < 0 || dup2(fd, STDOUT_FILENO) < 0 || dup2(fd, STDERR_FILENO) < 0) {
+    if (out >= 0) close(out);
+    if (err >= 0) close(err);
+    return -1;
+  }
+  int rc = status_native();
+  fflush(stdout);
+  fflush(stderr);
+  dup2(out, STDOUT_FILENO);
+  dup2(err, STDERR_FILENO);
+  close(out);
+  close(err);
+  return rc;
+}
+
+static char *const hp_log[] = {(char*)PYTHON3, (char*)LOG_TOOL, NULL};
+
+static const struct {
+  const char *title;
+  int (*native)(int fd); // in the shell; -1 = spawn instead
+  char *const *argv;     // spawned (NULL for status: systemctl)
+  long limit_ms;
+} g_health_probes[HEALTH_PROBES] = {
+  { "service status",                       hp_status, NULL,   10000 },
+  { "bot logs",                             NULL,      hp_log, 10000 },
+  { "disk (df -h / /tmp /opt/Innovations)", hp_disk,   NULL,    5000 },
+  { "memory (free -h)",                     hp_memory, NULL,    5000 },
+  { "time (date)",                          hp_clock,  NULL,    2000 },
+};
+
+static void health_dump(int fd)
+{
+  char buf[16384];
+  ssize_t n;
+  off_t off = 0;
+  fflush(stdout);
+  while ((n = pread(fd, buf, sizeof(buf), off)) > 0) {
+    fwrite(buf, 1, (size_t)n, stdout);
+    off += n;
+  }
+}
+
+static int sh_health(char **args)
+{
+  (void)args;
+  int fds[HEALTH_PROBES];
+  for (int i = 0; i < HEALTH_PROBES; i++) {
+    fds[i] = memfd_create("health", MFD_CLOEXEC);
+    if (fds[i] < 0) {
+      perror("trade: health: memfd_create");
+      while (i-- > 0) close(fds[i]);
+      return 1;
+    }
+  }
+
+  stage_wait st[HEALTH_PROBES];
+  char *const *argv[HEALTH_PROBES];
+  memset(st, 0, sizeof(st));
+  long start = mono_ns();
+  pipe_wait w = { .n = HEALTH_PROBES, .st = st, .start_ns = start, .probes = 1 };
+  int devnull = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  // spawned probes first, so they run while the shell answers the rest
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < HEALTH_PROBES; i++) {
+      stage_wait *s = &st[i];
+      if ((pass == 0) != !g_health_probes[i].native) continue;
+      s->name = g_health_probes[i].title;
+      s->deadline_ns = start + g_health_probes[i].limit_ms * 1000000L;
+      s->spawn_ns = mono_ns();
+      argv[i] = g_health_probes[i].argv;
+      if (g_health_probes[i].native) {
+        long saved = g_cmd_deadline_ns;
+        if (!g_cmd_deadline_ns || s->deadline_ns < g_cmd_deadline_ns) g_cmd_deadline_ns = s->deadline_ns;
+        s->rc = g_health_probes[i].native(fds[i]);
+        g_cmd_deadline_ns = saved;
+        if (s->rc >= 0) {
+          s->done = 1;
+          s->end_ns = mono_ns();
+          continue;
+        }
+        if (i == 0) argv[i] = cmd_build_argv(&cmd_table[CMD_STATUS], NULL);
+      }
+      long d = argv[i] ? cmd_deadline(argv[i]) : 0;
+      if (d && d < s->deadline_ns) s->deadline_ns = d;
+      spawn_req r = { .argv = argv[i], .fd_in = devnull, .fd_out = fds[i], .fd_err = fds[i], .setpgrp = g_jc };
+      s->pid = argv[i] ? spawn_proc(&r) : -1;
+      if (s->pid < 0) {
+        s->done = 1;
+        s->rc = 127;
+        s->end_ns = mono_ns();
+      } else {
+        w.left++;
+      }
+    }
+  }
+  if (devnull >= 0) close(devnull);
+  pipeline_wait(&w, -1);
+
+  puts("=== HEALTH CHECK ===");
+  int failed = 0;
+  char b[32];
+  for (int i = 0; i < HEALTH_PROBES; i++) {
+    stage_wait *s = &st[i];
+    if (s->pid > 0) trace_add_argv("exec", s->spawn_ns, s->end_ns, s->pid, argv[i]);
+    if (i == 0 && s->rc != 0 && !s->timed_out) dprintf(fds[0], "trade: status returned rc=%d\n", s->rc);
+    printf("%s[%d/%d] %s (%s%s)\n", i ? "\n" : "", i + 1, HEALTH_PROBES, s->name,
+           fmt_ns(b, sizeof(b), s->end_ns - s->spawn_ns), s->timed_out ? ", timed out" : "");
+    health_dump(fds[i]);
+    close(fds[i]);
+    failed |= s->rc != 0;
+  }
+  printf("\n=== END HEALTH (%s) ===\n", fmt_ns(b, sizeof(b), mono_ns() - start));
+  return failed;
+}
+
 // ====== single command executor ======
+// Returns the command's rc; builtins return theirs.
 static int execute_single(strvec *tokv)
 {
   // build args view
   char **args = tokens_to_args(tokv->items, 0, tokv->len);
-  if (!args || !args[0]) { free(args); return 1; }
+  if (!args || !args[0]) return 0;
 
   // parent builtins
-  cmd_kind pk = classify_parent_builtin(args[0]);
-  if (pk == CMD_PARENT_BUILTIN) {
-    for (int i = 0; i < num_builtins(); i++) {
-      if (strcmp(args[0], builtin_str[i]) == 0) {
-        int rc = (*builtin_func[i])(args);
-        free(args);
-        return rc;
-      }
-    }
+  const cmd_entry *e = cmd_lookup(args[0]);
+  g_cmd_name = args[0];
+  trace_dispatched();
+  if (e && e->kind == CMD_PARENT_BUILTIN) {
+    long t0 = trace_now();
+    int rc = e->builtin(args);
+    trace_add("builtin", t0, trace_now(), 0, args[0]);
+    return rc;
+  }
+
+  // exec-style, run in-process when the command has a native path
+  native_stage st;
+  if (e && e->native && e->native(args, &st)) {
+    fflush(stdout);
+    struct rusage r0, ru;
+    getrusage(RUSAGE_THREAD, &r0);
+    long t0 = trace_now();
+    int rc = st.run(&st, STDIN_FILENO, STDOUT_FILENO);
+    trace_add("exec", t0, trace_now(), 0, args[0]);
+    thread_use_since(&r0, &ru);
+    res_add(&g_line_use, &ru);
+    if (rc != 0) fprintf(stderr, "trade: command failed (rc=%d)\n", rc);
+    return rc;
   }
 
   // exec-style allowed
   char **exec_argv = NULL;
-  if (build_exec_argv(args, &exec_argv) == CMD_EXEC_ALLOWED && exec_argv) {
+  if (build_exec_argv(e, args, &exec_argv) == CMD_EXEC_ALLOWED && exec_argv) {
     int rc = run_cmd_capture_rc(exec_argv);
-    if (rc != 0) fprintf(stderr, "trade: command failed (rc=%d)\n", rc);
-    free(exec_argv);
-    free(args);
-    return 1;
+    if (rc != 0 && rc != 128 + SIGTSTP) fprintf(stderr, "trade: command failed (rc=%d)\n", rc);
+    return rc;
   }
 
   fprintf(stderr, "trade: unknown/blocked command: %s (type 'help')\n", args[0]);
-  free(args);
-  return 1;
+  return 127;
+}
+
+// One command of a list (a pipeline, possibly a single stage) with its
+// `time` / `timeout` prefixes; `bg` when it was followed by '&'.
+static int execute_command(strvec *cmdv, int bg)
+{
+  // prefixes: `time` reports what CMD used, `timeout DURATION` is a
+  // deadline for everything CMD spawns
+  strvec cmd = *cmdv;
+  int timed = 0;
+  for (;;) {
+    if (cmd.len > 1 && strcmp(cmd.items[0], "time") == 0) {
+      timed = 1;
+      cmd.items++;
+      cmd.len--;
+      continue;
+    }
+    if (strcmp(cmd.items[0], "timeout") == 0) {
+      long ms;
+      if (cmd.len < 3 || tok_is_pipe(cmd.items[1]) || !parse_duration_ms(cmd.items[1], &ms) || ms == 0) {
+        fprintf(stderr, "trade: usage: timeout DURATION COMMAND... (e.g. 5, 1.5, 30s, 2m)\n");
+        g_cmd_deadline_ns = 0;
+        return 2;
+      }
+      g_cmd_deadline_ns = mono_ns() + ms * 1000000L;
+      cmd.items += 2;
+      cmd.len -= 2;
+      continue;
+    }
+    break;
+  }
+  if (bg && (timed || g_cmd_deadline_ns)) {
+    fprintf(stderr, "trade: time/timeout cannot be used with '&'\n");
+    g_cmd_deadline_ns = 0;
+    return 2;
+  }
+
+  // if contains '|', run pipeline
+  int has_pipe = 0;
+  for (int i = 0; i < cmd.len; i++) {
+    if (tok_is_pipe(cmd.items[i])) { has_pipe = 1; break; }
+  }
+
+  memset(&g_line_use, 0, sizeof(g_line_use));
+  g_interrupted = 0;
+  g_line_words = cmd.items;
+  g_line_nwords = cmd.len;
+  long t0 = mono_ns();
+  int rc;
+  if (has_pipe || bg) {
+    rc = exec_pipeline(&cmd, timed, bg);
+  } else {
+    rc = execute_single(&cmd);
+    stats_record(cmd_lookup(cmd.items[0]), mono_ns() - t0, &g_line_use);
+  }
+  if (timed) res_print(has_pipe ? "total" : cmd.items[0], mono_ns() - t0, &g_line_use);
+
+  g_cmd_deadline_ns = 0;
+  g_cmd_name = NULL;
+  g_line_words = NULL;
+  g_line_nwords = 0;
+  return rc;
 }
 
-static int execute_line(const char *line)
+// `line` is tokenized in place and must be writable. A line is a list:
+// commands separated by ';', '&' (run the one before in the background),
+// '&&' / '||' (run the next one only if the last rc was / was not 0;
+// left to right, equal precedence). Returns the rc of the last command
+// run; Ctrl-C or `exit` ends the list.
+static int execute_line(char *line)
 {
   int perr = 0;
+  long tt = trace_now();
   strvec tokv = tokenize(line, &perr);
+  trace_add("tokenize", tt, trace_now(), 0, NULL);
+  g_trace_dispatch_ns = trace_now();
   if (perr) {
     fprintf(stderr, "trade: parse error (unclosed quote)\n");
     sv_free_all(&tokv);
-    return 1;
-  }
-  if (tokv.len == 0) {
-    sv_free_all(&tokv);
-    return 1;
+    return g_last_rc = 2;
   }
 
-  // if contains '|', run pipeline
-  int has_pipe = 0;
-  for (int i = 0; i < tokv.len; i++) {
-    if (strcmp(tokv.items[i], "|") == 0) { has_pipe = 1; break; }
+  // check the whole list before running any of it; only ';' and '&'
+  // may end it
+  for (int i = 0, start = 0; i <= tokv.len; i++) {
+    if (i < tokv.len && !tok_is_sep(tokv.items[i])) continue;
+    if (i == start && tokv.len > 0 &&
+        (i < tokv.len || tokv.items[i - 1] == TOK_AND || tokv.items[i - 1] == TOK_OR)) {
+      fprintf(stderr, "trade: parse error near '%s'\n", i < tokv.len ? tokv.items[i] : tokv.items[i - 1]);
+      sv_free_all(&tokv);
+      return g_last_rc = 2;
+    }
+    start = i + 1;
   }
 
-  int rc;
-  if (has_pipe) rc = exec_pipeline(&tokv);
-  else rc = execute_single(&tokv);
+  int rc = g_last_rc;
+  const char *op = NULL;     // separator before the current command
+  for (int i = 0, start = 0; i <= tokv.len; i++) {
+    if (i < tokv.len && !tok_is_sep(tokv.items[i])) continue;
+    const char *sep = i < tokv.len ? tokv.items[i] : NULL;
+    int run = op == TOK_AND ? rc == 0 : op == TOK_OR ? rc != 0 : 1;
+    if (i > start && run) {
+      strvec cmd = { .items = tokv.items + start, .len = i - start };
+      rc = execute_command(&cmd, sep == TOK_AMP);
+      g_last_rc = rc;
+      if (g_exit_requested || g_interrupted || rc == 128 + SIGINT) break;
+    }
+    // -e: an && / || chain may fail inside, but not at its end
+    if (g_errexit && rc != 0 && sep != TOK_AND && sep != TOK_OR) break;
+    op = sep;
+    start = i + 1;
+  }
 
+  g_trace_dispatch_ns = 0;
   sv_free_all(&tokv);
   return rc;
 }
@@ -1135,24 +5826,92 @@ static char *read_line(void)
 
 static void loop(void)
 {
-  int status = 1;
-  while (status) {
+  while (!g_exit_requested) {
+    jobs_reap();
+    long t0 = trace_now();
     char *line = read_line();
-    status = execute_line(line);
+    trace_add("read_line", t0, trace_now(), 0, NULL);
+    (void)execute_line(line);
+    arena_reset(&g_arena);
     free(line);
   }
 }
 
-int main(void)
+// -c / -f: lines from `in` through one reused buffer; no prompt, no
+// readline, no eager sudo probe. With -e (g_errexit) the first failing
+// list ends the run. Lines starting with '#' (and a #! line) are skipped.
+static int run_script(FILE *in)
+{
+  char *line = NULL;
+  size_t cap = 0;
+  while (!g_exit_requested && getline(&line, &cap, in) >= 0) {
+    jobs_reap();
+    const char *p = line + strspn(line, " \t");
+    if (*p == '#') continue;
+    int rc = execute_line(line);
+    arena_reset(&g_arena);
+    fflush(stdout);   // keep a 2>&1 log in order, one write per line
+    if (g_errexit && rc != 0) break;
+  }
+  free(line);
+  return g_last_rc;
+}
+
+static void usage_exit(void)
 {
+  fprintf(stderr, "usage: tradeshell [-e] [-c COMMANDS | -f SCRIPT|-]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  if (argc == 3 && strcmp(argv[1], "--priv-helper") == 0) priv_helper_main(argv[2]);
+
+  const char *cmd = NULL, *script = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "c:f:e")) != -1) {
+    switch (opt) {
+    case 'c': cmd = optarg; break;
+    case 'f': script = optarg; break;
+    case 'e': g_errexit = 1; break;
+    default: usage_exit();
+    }
+  }
+  if (optind < argc || (cmd && script)) usage_exit();
+
+  // before the chdir below, so a relative script path works
+  FILE *in = NULL;
+  if (cmd) {
+    in = fmemopen((void *)cmd, strlen(cmd), "r");
+  } else if (script) {
+    in = strcmp(script, "-") == 0 ? stdin : fopen(script, "re");
+  }
+  if ((cmd || script) && !in) {
+    fprintf(stderr, "trade: %s: %s\n", cmd ? "-c" : script, strerror(errno));
+    return 127;
+  }
+
+  zygote_start();
+  const char *ph = getenv("TRADE_PRIV_HELPER");
+  g_opt.privhelper = ph && strcmp(ph, "1") == 0;
+  if (g_opt.privhelper) fputs(PRIV_WARNING, stderr);
+
+  // native commands write to pipes themselves; EPIPE is handled there
+  signal(SIGPIPE, SIG_IGN);
+
   // Start in HOME directory if available
   const char *home = getenv("HOME");
   if (home && *home) {
     (void)chdir(home);
   }
 
+  scan_init();
+  exe_cache_init(!in);
+  jobs_init(!in);
+  if (in) return run_script(in);
+
   detect_sudo();
   printf("AutoTrade Shell (trade)  sudo=%s  type 'help'\n", g_use_sudo ? "on" : "off");
   loop();
-  return 0;
+  return g_last_rc;
 }
@@ -0,0 +1,123 @@
+#!/usr/bin/bash
+# run.sh - `status` from a fake cgroup v2 tree (TRADE_CGROUP_ROOT).
+#
+# fixture/ is a cgroup v2 root holding system.slice/fx-autotrade.service
+# with fixed cgroup.procs, memory.current, cpu.stat, io.stat and
+# pids.current; its only live process is pid 1 (4194305 is above any
+# pid_max and must be skipped). Further cases run on a copy with live
+# processes or files removed. systemctl is a stub on PATH and the bus
+# address leads nowhere, so a fallback shows up as "systemctl ...".
+#
+#   tests/cgroup/run.sh [TRADESHELL]    # default src/tradeshell
+set -uo pipefail
+
+HERE="$(cd "$(dirname "$0")" && pwd)"
+TS="$(realpath "${1:-$HERE/../../src/tradeshell}")"
+
+if [[ ! -x "$TS" ]]; then
+  echo "ERROR: $TS not built (run src/Compile.sh)" >&2
+  exit 1
+fi
+
+TMP="$(mktemp -d)"
+KIDS=""
+cleanup() {
+  [[ -n $KIDS ]] && kill $KIDS 2>/dev/null
+  rm -rf "$TMP"
+}
+trap cleanup EXIT
+
+mkdir "$TMP/bin"
+printf '#!/bin/sh\necho "systemctl $*"\nexit 3\n' > "$TMP/bin/systemctl"
+printf '#!/bin/sh\n[ "$1" = "-n" ] && shift\nexec "$@"\n' > "$TMP/bin/sudo"
+chmod +x "$TMP/bin/systemctl" "$TMP/bin/sudo"
+export PATH="$TMP/bin:$PATH"
+export DBUS_SYSTEM_BUS_ADDRESS="unix:path=$TMP/no-bus.sock"
+
+FAILS=0
+OUT=""
+# expect NAME RC REGEX LINE: run `tradeshell -c LINE`, want rc RC and
+# REGEX (grep -E) somewhere in stdout+stderr
+expect() {
+  local name="$1" want_rc="$2" re="$3" line="$4" rc
+  OUT="$(timeout 30 "$TS" -c "$line" 2>&1)"
+  rc=$?
+  if [[ $rc == "$want_rc" ]] && grep -Eq -- "$re" <<< "$OUT"; then
+    echo "ok   - $name"
+  else
+    echo "FAIL - $name (rc $rc, want $want_rc; want /$re/)"
+    sed 's/^/       | /' <<< "$OUT"
+    FAILS=$((FAILS + 1))
+  fi
+}
+
+# also NAME REGEX / never NAME REGEX: the output of the last expect
+# holds REGEX as well / does not hold it
+also() {
+  if grep -Eq -- "$2" <<< "$OUT"; then
+    echo "ok   - $1"
+  else
+    echo "FAIL - $1 (want /$2/)"
+    sed 's/^/       | /' <<< "$OUT"
+    FAILS=$((FAILS + 1))
+  fi
+}
+never() {
+  if ! grep -Eq -- "$2" <<< "$OUT"; then
+    echo "ok   - $1"
+  else
+    echo "FAIL - $1 (do not want /$2/)"
+    sed 's/^/       | /' <<< "$OUT"
+    FAILS=$((FAILS + 1))
+  fi
+}
+
+export TRADE_CGROUP_ROOT="$HERE/fixture"
+expect "fixture: header"   0 '^● fx-autotrade\.service$' "status"
+also   "fixture: active"     '^     Active: active \(running\) since .*; .* ago$'
+also   "fixture: main pid"   '^   Main PID: 1 \(.+\)$'
+also   "fixture: tasks"      '^      Tasks: 3$'
+also   "fixture: memory"     '^     Memory: 117\.7M \(123456789 bytes\)$'
+also   "fixture: cpu"        '^        CPU: 2500123us \(user 2000000us, system 500123us\)$'
+also   "fixture: io"         '^         IO: 1\.0M read, 2\.0M written$'
+never  "fixture: no systemctl" 'systemctl'
+expect "status --full is systemctl" 3 '^systemctl status fx-autotrade' "status --full"
+
+# Live processes: a shell (parent outside the cgroup) and its sleep
+# (parent inside). The shell is the main process; with no pids.current
+# the task count is the processes found.
+LIVE="$TMP/live"
+cp -r "$HERE/fixture" "$LIVE"
+CG="$LIVE/system.slice/fx-autotrade.service"
+sh -c 'sleep 60 & echo $! > "$1"; wait' sh "$TMP/sleep.pid" &
+MAIN=$!
+KIDS="$MAIN"
+for ((i = 0; i < 50; i++)); do
+  [[ -s $TMP/sleep.pid ]] && break
+  sleep 0.1
+done
+SLEEP="$(cat "$TMP/sleep.pid")"
+KIDS="$MAIN $SLEEP"
+printf '%s\n%s\n' "$SLEEP" "$MAIN" > "$CG/cgroup.procs"
+rm "$CG/pids.current" "$CG/io.stat" "$CG/memory.current"
+export TRADE_CGROUP_ROOT="$LIVE"
+expect "live: main pid"    0 "^   Main PID: $MAIN \\(sh\\)$" "status"
+also   "live: just started"  '; [0-9]+s ago$'
+also   "live: tasks counted" '^      Tasks: 2$'
+never  "live: no memory line" 'Memory:'
+never  "live: no io line"     'IO:'
+
+: > "$CG/cgroup.procs"
+expect "empty cgroup: falls back" 3 '^systemctl status fx-autotrade' "status"
+rm -r "$CG"
+expect "no unit cgroup: falls back" 3 '^systemctl status fx-autotrade' "status"
+mkdir -p "$CG"
+echo "$MAIN" > "$CG/cgroup.procs"
+rm "$LIVE/cgroup.controllers"
+expect "cgroup v1: falls back" 3 '^systemctl status fx-autotrade' "status"
+
+if ((FAILS)); then
+  echo "$FAILS failed"
+  exit 1
+fi
+echo "all passed"
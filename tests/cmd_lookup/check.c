@@ -0,0 +1,75 @@
+/*
+  check.c - cmd_lookup() against cmd_table.
+
+  Builds the shell itself into the check (as tools/bench/tokenize.c
+  does), so it tests the generated switch that the shell runs, whatever
+  python the build had or did not have:
+    1. every cmd_table[i].name looks up to &cmd_table[i];
+    2. no near miss (one byte changed, one byte more or less, other
+       case) of a name looks up to anything but the command it names.
+  Prints each failure; exits 1 if there was one.
+*/
+#define main tradeshell_main
+#include "../../src/tradeshell.c"
+#undef main
+
+static int g_fails;
+
+static void want(const char *name, const cmd_entry *e)
+{
+  const cmd_entry *got = cmd_lookup(name);
+  if (got == e) return;
+  printf("FAIL - cmd_lookup(\"%s\") = %s, want %s\n", name,
+         got ? got->name : "NULL", e ? e->name : "NULL");
+  g_fails++;
+}
+
+// the entry named name exactly, by a plain scan of the table
+static const cmd_entry *scan(const char *name)
+{
+  for (int i = 0; i < CMD_NCOMMANDS; i++) {
+    if (strcmp(cmd_table[i].name, name) == 0) return &cmd_table[i];
+  }
+  return NULL;
+}
+
+int main(void)
+{
+  char buf[64];
+  for (int i = 0; i < CMD_NCOMMANDS; i++) {
+    const char *name = cmd_table[i].name;
+    size_t n = strlen(name);
+    if (n + 2 > sizeof(buf)) {
+      printf("FAIL - %s: name too long for the check\n", name);
+      g_fails++;
+      continue;
+    }
+    want(name, &cmd_table[i]);
+    for (size_t p = 0; p < n; p++) {
+      static const char subst[] = "aexz-_Z0";
+      for (const char *c = subst; *c; c++) {
+        if (*c == name[p]) continue;
+        memcpy(buf, name, n + 1);
+        buf[p] = *c;
+        want(buf, scan(buf));
+      }
+      memcpy(buf, name, n + 1);
+      buf[p] = (char)toupper((unsigned char)buf[p]);
+      want(buf, scan(buf));
+    }
+    memcpy(buf, name, n - 1);
+    buf[n - 1] = '\0';
+    want(buf, scan(buf));
+    memcpy(buf, name, n);
+    buf[n] = 's';
+    buf[n + 1] = '\0';
+    want(buf, scan(buf));
+  }
+  want("", NULL);
+  if (g_fails) {
+    printf("%d failed\n", g_fails);
+    return 1;
+  }
+  printf("ok   - %d names round-trip through cmd_lookup\n", CMD_NCOMMANDS);
+  return 0;
+}
@@ -0,0 +1,24 @@
+#!/usr/bin/bash
+# run.sh - build check.c (the shell plus a cmd_lookup check) and run it.
+#
+# The build's gen_cmd_lookup.py --check compares the generated switch
+# with cmd_table; this checks what the switch does, and runs wherever a
+# C compiler does.
+#
+#   tests/cmd_lookup/run.sh             # CC defaults to gcc
+set -uo pipefail
+
+HERE="$(cd "$(dirname "$0")" && pwd)"
+CC="${CC:-gcc}"
+
+TMP="$(mktemp -d)"
+trap 'rm -rf "$TMP"' EXIT
+
+if ! "$CC" -O2 -Wall -Wextra -pthread -o "$TMP/check" "$HERE/check.c"; then
+  echo "ERROR: check.c did not build" >&2
+  exit 1
+fi
+if ! "$TMP/check"; then
+  exit 1
+fi
+echo "all passed"
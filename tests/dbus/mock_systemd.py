@@ -0,0 +1,299 @@
+#!/usr/bin/env python3
+"""Mock org.freedesktop.systemd1 manager for the shell's D-Bus client.
+
+Connects to $DBUS_SYSTEM_BUS_ADDRESS (a private dbus-daemon started with
+bus.conf), owns org.freedesktop.systemd1 and answers the calls the shell
+makes: StartUnit/StopUnit/RestartUnit (reply with a job path, then emit
+Manager.JobRemoved for it), LoadUnit and Properties.GetAll on the Unit
+and Service interfaces. Speaks the wire protocol directly, so it needs
+nothing beyond python3 and dbus-daemon.
+
+    mock_systemd.py MODE
+
+MODE:
+  ok      jobs finish with result "done"
+  fail    jobs finish with result "failed"
+  early   JobRemoved is sent before the method reply
+  deny    job calls fail with AccessDenied
+  nounit  job calls fail with NoSuchUnit; LoadState is "not-found"
+  hang    jobs never finish (no JobRemoved)
+
+Each job call is logged to stdout as "call MEMBER UNIT MODE".
+
+With MOCK_LAST_TEMP set, each successful StartUnit/RestartUnit also plays
+the bot for restart --wait: after BOT_DELAY it makes a new dir under
+$MOCK_BOT_DIR (default /tmp), names it in $MOCK_LAST_TEMP (as the bot does last_temp.txt) and writes
+BOT_LINES to fx_debug_log.txt there, one every BOT_DELAY.
+"""
+import os
+import socket
+import struct
+import sys
+import tempfile
+import threading
+import time
+
+MODE = sys.argv[1] if len(sys.argv) > 1 else "ok"
+MANAGER = "org.freedesktop.systemd1.Manager"
+UNIT_PATH = "/org/freedesktop/systemd1/unit/fx_2dautotrade_2eservice"
+BOT_DELAY = 0.3
+BOT_LINES = ["boot", "loading config", "connecting", "READY trading"]
+
+
+def bus_path():
+    addr = os.environ.get("DBUS_SYSTEM_BUS_ADDRESS", "")
+    for part in addr.split(","):
+        if part.startswith("unix:path="):
+            return part[len("unix:path="):]
+    sys.exit("mock_systemd: DBUS_SYSTEM_BUS_ADDRESS must be unix:path=...")
+
+
+class Writer:
+    """Little-endian D-Bus marshaller for the few types used here."""
+
+    def __init__(self):
+        self.b = bytearray()
+
+    def pad(self, a):
+        self.b += b"\0" * ((a - len(self.b) % a) % a)
+
+    def u32(self, v):
+        self.pad(4)
+        self.b += struct.pack("<I", v)
+
+    def u64(self, v):
+        self.pad(8)
+        self.b += struct.pack("<Q", v)
+
+    def str(self, v):
+        v = v.encode()
+        self.u32(len(v))
+        self.b += v + b"\0"
+
+    def sig(self, v):
+        v = v.encode()
+        self.b += bytes([len(v)]) + v + b"\0"
+
+    def variant(self, t, v):
+        self.sig(t)
+        if t == "as":
+            self.u32(0)
+            at = len(self.b)
+            for x in v:
+                self.str(x)
+            struct.pack_into("<I", self.b, at - 4, len(self.b) - at)
+            return
+        {"s": self.str, "o": self.str, "u": self.u32, "t": self.u64}[t](v)
+
+
+class Bus:
+    def __init__(self, path):
+        self.s = socket.socket(socket.AF_UNIX)
+        self.s.connect(path)
+        self.s.sendall(b"\0AUTH EXTERNAL " + str(os.geteuid()).encode().hex().encode() + b"\r\n")
+        self.buf = b""
+        while b"\r\n" not in self.buf:
+            self.buf += self.s.recv(4096)
+        if not self.buf.startswith(b"OK"):
+            sys.exit("mock_systemd: auth failed: %r" % self.buf)
+        self.buf = self.buf[self.buf.index(b"\r\n") + 2:]
+        self.s.sendall(b"BEGIN\r\n")
+        self.serial = 0
+
+    def send(self, mtype, fields, sig, body):
+        self.serial += 1
+        h = Writer()
+        h.b += bytes([ord("l"), mtype, 0, 1])
+        h.u32(len(body))
+        h.u32(self.serial)
+        h.u32(0)
+        start = len(h.b)
+        for code, t, v in fields + ([(8, "g", sig)] if sig else []):
+            h.pad(8)
+            h.b += bytes([code])
+            h.sig(t)
+            if t == "g":
+                h.sig(v)
+            elif t == "u":
+                h.u32(v)
+            else:
+                h.str(v)
+        struct.pack_into("<I", h.b, 12, len(h.b) - start)
+        h.pad(8)
+        self.s.sendall(bytes(h.b) + bytes(body))
+        return self.serial
+
+    def recv(self):
+        """(type, serial, {field code: value}, body) of the next message."""
+        while len(self.buf) < 16:
+            self.buf += self.s.recv(65536)
+        blen, serial, flen = struct.unpack_from("<III", self.buf, 4)
+        hlen = (16 + flen + 7) & ~7
+        while len(self.buf) < hlen + blen:
+            self.buf += self.s.recv(65536)
+        m, self.buf = self.buf[:hlen + blen], self.buf[hlen + blen:]
+        fields, p = {}, 16
+        while p < 16 + flen:
+            p = (p + 7) & ~7
+            code, n = m[p], m[p + 1]
+            t = m[p + 2:p + 2 + n].decode()
+            p += 3 + n
+            if t in "so":
+                p = (p + 3) & ~3
+                l, = struct.unpack_from("<I", m, p)
+                fields[code] = m[p + 4:p + 4 + l].decode()
+                p += 5 + l
+            elif t == "g":
+                l = m[p]
+                fields[code] = m[p + 1:p + 1 + l].decode()
+                p += 2 + l
+            elif t == "u":
+                p = (p + 3) & ~3
+                fields[code], = struct.unpack_from("<I", m, p)
+                p += 4
+        return m[1], serial, fields, m[hlen:]
+
+    def call_bus(self, member, sig=None, body=b""):
+        ser = self.send(1, [(1, "o", "/org/freedesktop/DBus"), (2, "s", "org.freedesktop.DBus"),
+                            (3, "s", member), (6, "s", "org.freedesktop.DBus")], sig, body)
+        while True:
+            t, _, f, b = self.recv()
+            if f.get(5) == ser:
+                return t, b
+
+
+def read_str(b, p):
+    p = (p + 3) & ~3
+    l, = struct.unpack_from("<I", b, p)
+    return b[p + 4:p + 4 + l].decode(), p + 5 + l
+
+
+def bot(last_temp):
+    time.sleep(BOT_DELAY)
+    d = tempfile.mkdtemp(prefix="tmpfx", dir=os.environ.get("MOCK_BOT_DIR", "/tmp"))
+    with open(d + "/fx_debug_log.txt", "w") as log:
+        with open(last_temp, "w") as f:
+            f.write("started\n%s\n" % d)
+        for line in BOT_LINES:
+            time.sleep(BOT_DELAY)
+            log.write(time.strftime("%Y-%m-%d %H:%M:%S ") + line + "\n")
+            log.flush()
+
+
+def unit_props(state):
+    if_unit = [
+        ("Id", "s", "fx-autotrade.service"),
+        ("Description", "s", "FX AutoTrade"),
+        ("LoadState", "s", "not-found" if MODE == "nounit" else "loaded"),
+        ("ActiveState", "s", state["active"]),
+        ("SubState", "s", state["sub"]),
+        ("FragmentPath", "s", "/etc/systemd/system/fx-autotrade.service"),
+        ("ActiveEnterTimestamp", "t", int((time.time() - 3725) * 1e6)),
+        ("Names", "as", ["fx-autotrade.service", "fx.service"]),   # a type the client skips
+    ]
+    if_service = [
+        ("MainPID", "u", state["pid"]),
+        ("MemoryCurrent", "t", 123456789),
+        ("CPUUsageNSec", "t", 2500000000),
+        ("TasksCurrent", "t", 7),
+        ("Result", "s", "success"),
+    ]
+    return if_unit, if_service
+
+
+def main():
+    bus = Bus(bus_path())
+    bus.call_bus("Hello")
+    w = Writer()
+    w.str("org.freedesktop.systemd1")
+    w.u32(4)   # DBUS_NAME_FLAG_DO_NOT_QUEUE
+    # a mock from the previous mode may not have let go of the name yet
+    for _ in range(50):
+        _, b = bus.call_bus("RequestName", "su", w.b)
+        if struct.unpack_from("<I", b)[0] == 1:   # PRIMARY_OWNER
+            break
+        time.sleep(0.1)
+    else:
+        sys.exit("mock_systemd: org.freedesktop.systemd1 is taken")
+    print("mock ready", flush=True)
+
+    state = {"active": "active", "sub": "running", "pid": 4242}
+    jobs = 0
+    while True:
+        t, serial, f, body = bus.recv()
+        if t != 1:
+            continue
+        sender, member = f.get(7), f.get(3)
+
+        def reply(sig=None, b=b""):
+            bus.send(2, [(5, "u", serial), (6, "s", sender)], sig, b)
+
+        def error(name, msg):
+            w = Writer()
+            w.str(msg)
+            bus.send(3, [(5, "u", serial), (6, "s", sender), (4, "s", name)], "s", w.b)
+
+        if member in ("StartUnit", "StopUnit", "RestartUnit"):
+            unit, p = read_str(body, 0)
+            mode, _ = read_str(body, p)
+            print("call", member, unit, mode, flush=True)
+            if MODE == "deny":
+                error("org.freedesktop.DBus.Error.AccessDenied", "denied")
+                continue
+            if MODE == "nounit":
+                error("org.freedesktop.systemd1.NoSuchUnit", "Unit %s not found." % unit)
+                continue
+            jobs += 1
+            job = "/org/freedesktop/systemd1/job/%d" % jobs
+            result = "failed" if MODE == "fail" else "done"
+            removed = Writer()
+            removed.u32(jobs)
+            removed.str(job)
+            removed.str(unit)
+            removed.str(result)
+            path = Writer()
+            path.str(job)
+
+            def job_removed():
+                bus.send(4, [(1, "o", "/org/freedesktop/systemd1"), (2, "s", MANAGER),
+                             (3, "s", "JobRemoved")], "uoss", removed.b)
+
+            if MODE == "early":
+                job_removed()
+                reply("o", path.b)
+            elif MODE == "hang":
+                reply("o", path.b)
+            else:
+                reply("o", path.b)
+                time.sleep(0.05)
+                job_removed()
+            if result == "done" and member != "StopUnit" and os.environ.get("MOCK_LAST_TEMP"):
+                threading.Thread(target=bot, args=(os.environ["MOCK_LAST_TEMP"],), daemon=True).start()
+            if result == "done":
+                stopped = member == "StopUnit"
+                state["active"] = "inactive" if stopped else "active"
+                state["sub"] = "dead" if stopped else "running"
+                state["pid"] = 0 if stopped else 4242
+        elif member == "LoadUnit":
+            w = Writer()
+            w.str(UNIT_PATH)
+            reply("o", w.b)
+        elif member == "GetAll":
+            iface, _ = read_str(body, 0)
+            if_unit, if_service = unit_props(state)
+            w = Writer()
+            w.u32(0)
+            w.pad(8)
+            start = len(w.b)
+            for k, ty, v in (if_unit if iface.endswith(".Unit") else if_service):
+                w.pad(8)
+                w.str(k)
+                w.variant(ty, v)
+            struct.pack_into("<I", w.b, 0, len(w.b) - start)
+            reply("a{sv}", w.b)
+        else:
+            error("org.freedesktop.DBus.Error.UnknownMethod", member)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,185 @@
+#!/usr/bin/bash
+# run.sh - start/stop/restart/status over D-Bus against a mock systemd,
+# and restart --wait readiness against the mock's fake bot.
+#
+# Starts a private dbus-daemon (bus.conf) and mock_systemd.py on it, points
+# the shell at it with DBUS_SYSTEM_BUS_ADDRESS, and checks each verb's
+# output and rc for every mock mode. systemctl and sudo are stubs on PATH,
+# so the systemctl fallback shows up as "systemctl VERB ..." in the output
+# and nothing touches the real system. TRADE_CGROUP_ROOT points at an
+# empty dir, so status always asks the bus. For restart --wait the mock
+# writes the bot's last_temp.txt (TRADE_LAST_TEMP_FILE) and log under the
+# test dir.
+#
+#   tests/dbus/run.sh [TRADESHELL]      # default src/tradeshell
+#
+# Needs dbus-daemon and python3; exits 77 (skip) without them.
+set -uo pipefail
+
+HERE="$(cd "$(dirname "$0")" && pwd)"
+TS="$(realpath "${1:-$HERE/../../src/tradeshell}")"
+
+if [[ ! -x "$TS" ]]; then
+  echo "ERROR: $TS not built (run src/Compile.sh)" >&2
+  exit 1
+fi
+for tool in dbus-daemon python3; do
+  if ! command -v "$tool" >/dev/null 2>&1; then
+    echo "SKIP: $tool not found"
+    exit 77
+  fi
+done
+
+# under /tmp: last_temp.txt may only name /tmp dirs
+TMP="$(mktemp -d /tmp/tradeshell-test.XXXXXX)"
+DAEMON=""
+MOCK=""
+cleanup() {
+  [[ -n $MOCK ]] && kill "$MOCK" 2>/dev/null
+  [[ -n $DAEMON ]] && kill "$DAEMON" 2>/dev/null
+  rm -rf "$TMP"
+}
+trap cleanup EXIT
+
+mkdir "$TMP/bin" "$TMP/cgroup"
+printf '#!/bin/sh\necho "systemctl $*"\nexit 3\n' > "$TMP/bin/systemctl"
+printf '#!/bin/sh\n[ "$1" = "-n" ] && shift\nexec "$@"\n' > "$TMP/bin/sudo"
+chmod +x "$TMP/bin/systemctl" "$TMP/bin/sudo"
+
+export DBUS_SYSTEM_BUS_ADDRESS="unix:path=$TMP/bus.sock"
+export TRADE_CGROUP_ROOT="$TMP/cgroup"
+export PATH="$TMP/bin:$PATH"
+
+dbus-daemon --config-file="$HERE/bus.conf" --address="$DBUS_SYSTEM_BUS_ADDRESS" \
+  --nofork >/dev/null 2>&1 &
+DAEMON=$!
+for ((i = 0; i < 50; i++)); do
+  [[ -S $TMP/bus.sock ]] && break
+  sleep 0.1
+done
+
+# mock MODE: (re)start the mock manager and wait until it owns its name
+mock() {
+  if [[ -n $MOCK ]]; then kill "$MOCK" 2>/dev/null; wait "$MOCK" 2>/dev/null; fi
+  : > "$TMP/mock.log"   # not the child: it may not have truncated it yet
+  python3 "$HERE/mock_systemd.py" "$1" >> "$TMP/mock.log" 2>&1 &
+  MOCK=$!
+  for ((i = 0; i < 50; i++)); do
+    grep -q "mock ready" "$TMP/mock.log" && return 0
+    sleep 0.1
+  done
+  echo "ERROR: mock_systemd.py $1 did not start" >&2
+  cat "$TMP/mock.log" >&2
+  exit 1
+}
+
+FAILS=0
+OUT=""
+# expect NAME RC REGEX LINE: run `tradeshell -c LINE`, want rc RC and
+# REGEX (grep -E) somewhere in stdout+stderr
+expect() {
+  local name="$1" want_rc="$2" re="$3" line="$4" rc
+  OUT="$(timeout 30 "$TS" -c "$line" 2>&1)"
+  rc=$?
+  if [[ $rc == "$want_rc" ]] && grep -Eq -- "$re" <<< "$OUT"; then
+    echo "ok   - $name"
+  else
+    echo "FAIL - $name (rc $rc, want $want_rc; want /$re/)"
+    sed 's/^/       | /' <<< "$OUT"
+    FAILS=$((FAILS + 1))
+  fi
+}
+
+# also NAME REGEX: the output of the last expect holds REGEX as well
+also() {
+  if grep -Eq -- "$2" <<< "$OUT"; then
+    echo "ok   - $1"
+  else
+    echo "FAIL - $1 (want /$2/)"
+    sed 's/^/       | /' <<< "$OUT"
+    FAILS=$((FAILS + 1))
+  fi
+}
+
+# called NAME REGEX: the mock saw a matching job call
+called() {
+  if grep -Eq -- "$2" "$TMP/mock.log"; then
+    echo "ok   - $1"
+  else
+    echo "FAIL - $1 (no /$2/ in mock log)"
+    sed 's/^/       | /' "$TMP/mock.log"
+    FAILS=$((FAILS + 1))
+  fi
+}
+
+mock ok
+expect "ok: start"              0 '^trade: started\.$'   "start"
+expect "ok: restart"            0 '^trade: restarted\.$' "restart"
+expect "ok: status running"     0 'Active: active \(running\).*' "status"
+expect "ok: status main pid"    0 'Main PID: 4242' "status"
+expect "ok: status memory"      0 'Memory: 117\.7M' "status"
+expect "ok: stop"               0 '^trade: stopped\.$'   "stop"
+expect "ok: status stopped"     3 'Active: inactive \(dead\)' "status"
+called "ok: StartUnit sent"     '^call StartUnit fx-autotrade\.service replace$'
+called "ok: RestartUnit sent"   '^call RestartUnit fx-autotrade\.service replace$'
+called "ok: StopUnit sent"      '^call StopUnit fx-autotrade\.service replace$'
+
+mock fail
+expect "fail: start"   1 'job for fx-autotrade\.service failed' "start"
+expect "fail: stop"    1 'job for fx-autotrade\.service failed' "stop"
+
+mock early
+expect "early JobRemoved: start"   0 '^trade: started\.$'   "start"
+expect "early JobRemoved: restart" 0 '^trade: restarted\.$' "restart"
+
+mock deny
+expect "denied: falls back to systemctl" 3 '^systemctl start fx-autotrade$' "start"
+
+mock nounit
+expect "no unit: start falls back"  3 '^systemctl stop fx-autotrade$' "stop"
+expect "no unit: status"            4 'could not be found' "status"
+
+mock hang
+expect "hung job: timeout prefix" 124 'timed out after 1\.0s' "timeout 1 start"
+
+mock ok
+expect "set dbus off: systemctl" 3 '^systemctl restart fx-autotrade$' "set dbus off; restart"
+if grep -q "^call" "$TMP/mock.log"; then
+  echo "FAIL - set dbus off: the bus was still used"
+  FAILS=$((FAILS + 1))
+else
+  echo "ok   - set dbus off: bus not used"
+fi
+
+# restart --wait: stop, start, then the bot's lines come BOT_DELAY (0.3s)
+# apart after a 0.3s start-up, so READY lands about 1.5s after the start
+# and the first line about 0.6s after it
+LOG_RE='/tmp/tradeshell-test\.[^/]+/tmpfx[^/]+/fx_debug_log\.txt'
+export TRADE_LAST_TEMP_FILE="$TMP/last_temp.txt"
+: > "$TRADE_LAST_TEMP_FILE"
+MOCK_LAST_TEMP="$TRADE_LAST_TEMP_FILE" MOCK_BOT_DIR="$TMP" mock ok
+expect "ready: marker"           0 "^trade: ready in 1\.[0-9]{2}s \($LOG_RE\)$" "restart --wait READY"
+also   "ready: stop timed"         '^trade: stopped in [0-9.]+(us|ms|s)$'
+also   "ready: start timed"        '^trade: started in [0-9.]+(us|ms|s)$'
+also   "ready: downtime"           '^trade: restarted; down [12]\.[0-9]{2}s$'
+expect "ready: any line"         0 '^trade: ready in [0-9.]+ms ' "restart --wait"
+TRADE_READY_MARKER=READY \
+expect "ready: TRADE_READY_MARKER" 0 '^trade: ready in 1\.[0-9]{2}s ' "restart --wait"
+expect "ready: marker timeout"   124 "not ready after 1\.[0-9]{2}s \(no \"NEVER\" in $LOG_RE\)" \
+  "set readytimeout 1; restart --wait NEVER"
+TRADE_READY_MARKER=NEVER \
+expect "ready: TRADE_READY_MARKER timeout" 124 "not ready after 1\.[0-9]{2}s \(no \"NEVER\" in $LOG_RE\)" \
+  "set readytimeout 1; restart --wait"
+expect "ready: timeout prefix"   124 'no "NEVER" in' "timeout 1 restart --wait NEVER"
+
+: > "$TRADE_LAST_TEMP_FILE"
+mock ok                                         # no bot this time
+expect "ready: no log dir"       124 "names no /tmp dir" "set readytimeout 1; restart --wait"
+mock fail
+expect "ready: stop fails"       1 '^trade: stop failed \(rc=1\)$' "restart --wait"
+
+if ((FAILS)); then
+  echo "$FAILS failed"
+  exit 1
+fi
+echo "all passed"
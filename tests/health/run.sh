@@ -0,0 +1,104 @@
+#!/usr/bin/bash
+# run.sh - the disk probe of `health` against a large mountinfo
+# (TRADE_MOUNTINFO).
+#
+# The generated mountinfo holds about 64K of filler mounts on a device
+# nothing here lives on, then the entries for / and /tmp with the real
+# st_dev of each, so a copy cut at 16K (or at any fixed size) loses them
+# and shows "-" and the path itself. systemctl is a stub on PATH and the
+# bus address leads nowhere, so the status probe fails and health
+# returns 1 whatever the disks say.
+#
+#   tests/health/run.sh [TRADESHELL]    # default src/tradeshell
+set -uo pipefail
+
+HERE="$(cd "$(dirname "$0")" && pwd)"
+TS="$(realpath "${1:-$HERE/../../src/tradeshell}")"
+
+if [[ ! -x "$TS" ]]; then
+  echo "ERROR: $TS not built (run src/Compile.sh)" >&2
+  exit 1
+fi
+
+TMP="$(mktemp -d)"
+trap 'rm -rf "$TMP"' EXIT
+
+mkdir "$TMP/bin" "$TMP/cgroup"
+printf '#!/bin/sh\necho "systemctl $*"\nexit 3\n' > "$TMP/bin/systemctl"
+printf '#!/bin/sh\n[ "$1" = "-n" ] && shift\nexec "$@"\n' > "$TMP/bin/sudo"
+chmod +x "$TMP/bin/systemctl" "$TMP/bin/sudo"
+export PATH="$TMP/bin:$PATH"
+export DBUS_SYSTEM_BUS_ADDRESS="unix:path=$TMP/no-bus.sock"
+export TRADE_CGROUP_ROOT="$TMP/cgroup"
+
+# majmin PATH: st_dev of PATH as mountinfo's MAJ:MIN (glibc's encoding)
+majmin() {
+  local d
+  d=$(stat -c %d "$1")
+  echo "$(( ((d >> 8) & 0xfff) | ((d >> 32) & ~0xfff) )):$(( (d & 0xff) | ((d >> 12) & ~0xff) ))"
+}
+
+MI="$TMP/mountinfo"
+for ((i = 100; i < 700; i++)); do
+  echo "$i 1 4095:$i / /srv/filler/mount-$i rw,relatime shared:$i - xfs /dev/mapper/filler-$i rw,attr2,inode64,noquota"
+done > "$MI"
+echo "900 1 $(majmin /) / / rw,relatime shared:1 - ext4 /dev/fake-root rw" >> "$MI"
+echo "901 900 $(majmin /tmp) / /tmp rw,nosuid,nodev shared:2 - tmpfs fake-tmp rw" >> "$MI"
+if (($(stat -c %s "$MI") <= 16384)); then
+  echo "ERROR: $MI is not over 16K" >&2
+  exit 1
+fi
+
+FAILS=0
+OUT=""
+# expect NAME RC REGEX LINE: run `tradeshell -c LINE`, want rc RC and
+# REGEX (grep -E) somewhere in stdout+stderr
+expect() {
+  local name="$1" want_rc="$2" re="$3" line="$4" rc
+  OUT="$(timeout 30 "$TS" -c "$line" 2>&1)"
+  rc=$?
+  if [[ $rc == "$want_rc" ]] && grep -Eq -- "$re" <<< "$OUT"; then
+    echo "ok   - $name"
+  else
+    echo "FAIL - $name (rc $rc, want $want_rc; want /$re/)"
+    sed 's/^/       | /' <<< "$OUT"
+    FAILS=$((FAILS + 1))
+  fi
+}
+
+# also NAME REGEX / never NAME REGEX: the output of the last expect
+# holds REGEX as well / does not hold it
+also() {
+  if grep -Eq -- "$2" <<< "$OUT"; then
+    echo "ok   - $1"
+  else
+    echo "FAIL - $1 (want /$2/)"
+    sed 's/^/       | /' <<< "$OUT"
+    FAILS=$((FAILS + 1))
+  fi
+}
+never() {
+  if grep -Eq -- "$2" <<< "$OUT"; then
+    echo "FAIL - $1 (want no /$2/)"
+    sed 's/^/       | /' <<< "$OUT"
+    FAILS=$((FAILS + 1))
+  else
+    echo "ok   - $1"
+  fi
+}
+
+export TRADE_MOUNTINFO="$MI"
+expect "large mountinfo: / row"    1 '^/dev/fake-root +[0-9.]+[KMGTPE]? .* /$' "health"
+also   "large mountinfo: /tmp row"   '^fake-tmp +[0-9.]+[KMGTPE]? .* /tmp$'
+never  "large mountinfo: no guesses" '^- '
+never  "large mountinfo: no error"   '^df: .*mountinfo'
+
+export TRADE_MOUNTINFO="$TMP/missing"
+expect "no mountinfo: reported" 1 "^df: $TMP/missing: No such file or directory$" "health"
+also   "no mountinfo: rows kept"  '^- +[0-9.]+[KMGTPE]? .* /$'
+
+if ((FAILS)); then
+  echo "$FAILS failed"
+  exit 1
+fi
+echo "all passed"
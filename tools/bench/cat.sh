@@ -0,0 +1,56 @@
+#!/usr/bin/bash
+# cat.sh - throughput of the native cat against coreutils cat.
+#
+# The native cat picks copy_file_range (file to file), sendfile (file to
+# anything else) or splice (pipe input) in copy_fd(); this times each
+# case so that choice can be re-checked on a new kernel or filesystem.
+#
+#   tools/bench/cat.sh [TRADESHELL] [SIZE_MB]    # default src/tradeshell, 512
+#
+# The source file is read once first, so every run is from page cache.
+# Prints the best of RUNS (default 5) in MB/s; tradeshell times include
+# its own start-up, about a millisecond.
+set -euo pipefail
+
+TS="$(realpath "${1:-$(dirname "$0")/../../src/tradeshell}")"
+SIZE_MB="${2:-512}"
+RUNS="${RUNS:-5}"
+
+if [[ ! -x "$TS" ]]; then
+  echo "ERROR: $TS not built (run src/Compile.sh)" >&2
+  exit 1
+fi
+
+TMP="$(mktemp -d)"
+trap 'rm -rf "$TMP"' EXIT
+SRC="$TMP/src.bin"
+head -c "$((SIZE_MB << 20))" /dev/urandom > "$SRC"
+cat "$SRC" > /dev/null
+
+# best wall time of RUNS runs of "$@", printed as MB/s
+best_mbs() {
+  local best=0 t0 t1 ns
+  for ((i = 0; i < RUNS; i++)); do
+    t0=$(date +%s%N)
+    "$@"
+    t1=$(date +%s%N)
+    ns=$((t1 - t0))
+    if ((best == 0 || ns < best)); then best=$ns; fi
+  done
+  awk -v b="$SIZE_MB" -v ns="$best" 'BEGIN { printf "%8.0f MB/s", b * 1048576 / ns * 1000 }'
+}
+
+ts_file()    { "$TS" -c "cat $SRC" > "$TMP/out"; }
+cu_file()    { cat "$SRC" > "$TMP/out"; }
+ts_pipe()    { "$TS" -c "cat $SRC" | cat > /dev/null; }
+cu_pipe()    { cat "$SRC" | cat > /dev/null; }
+ts_null()    { "$TS" -c "cat $SRC" > /dev/null; }
+cu_null()    { cat "$SRC" > /dev/null; }
+ts_fromp()   { cat "$SRC" | "$TS" -c "cat" > "$TMP/out"; }
+cu_fromp()   { cat "$SRC" | cat > "$TMP/out"; }
+
+printf "%-26s %14s %14s   (%d MB, best of %d)\n" "case" "tradeshell" "coreutils" "$SIZE_MB" "$RUNS"
+printf "%-26s %14s %14s\n" "file -> file" "$(best_mbs ts_file)" "$(best_mbs cu_file)"
+printf "%-26s %14s %14s\n" "file -> pipe" "$(best_mbs ts_pipe)" "$(best_mbs cu_pipe)"
+printf "%-26s %14s %14s\n" "file -> /dev/null" "$(best_mbs ts_null)" "$(best_mbs cu_null)"
+printf "%-26s %14s %14s\n" "pipe -> file" "$(best_mbs ts_fromp)" "$(best_mbs cu_fromp)"
@@ -0,0 +1,74 @@
+#!/usr/bin/bash
+# pipeline.sh - MB/s through 2-, 3- and 5-stage pipelines per pipe size.
+#
+# Each pipeline moves SIZE_MB of page-cached data through external
+# `cat -u` stages (one write per read), with `set pipesize` at the
+# kernel default, 64K and 1M. The "mixed" rows alternate with plain
+# `cat`, which the shell fuses into the stage before it. bash runs the
+# same lines for reference.
+#
+#   tools/bench/pipeline.sh [TRADESHELL] [SIZE_MB]   # default src/tradeshell, 512
+#
+# sudo is shimmed on PATH (cat always runs through sudo), so no password
+# or root is needed. Prints the best of RUNS (default 5).
+set -euo pipefail
+
+TS="$(realpath "${1:-$(dirname "$0")/../../src/tradeshell}")"
+SIZE_MB="${2:-512}"
+RUNS="${RUNS:-5}"
+
+if [[ ! -x "$TS" ]]; then
+  echo "ERROR: $TS not built (run src/Compile.sh)" >&2
+  exit 1
+fi
+
+TMP="$(mktemp -d)"
+trap 'rm -rf "$TMP"' EXIT
+SRC="$TMP/src.bin"
+head -c "$((SIZE_MB << 20))" /dev/urandom > "$SRC"
+cat "$SRC" > /dev/null
+
+mkdir "$TMP/bin"
+printf '#!/bin/sh\n[ "$1" = "-n" ] && shift\nexec "$@"\n' > "$TMP/bin/sudo"
+chmod +x "$TMP/bin/sudo"
+export PATH="$TMP/bin:$PATH"
+
+# best wall time of RUNS runs of "$@", printed as MB/s
+best_mbs() {
+  local best=0 t0 t1 ns
+  for ((i = 0; i < RUNS; i++)); do
+    t0=$(date +%s%N)
+    "$@" > /dev/null
+    t1=$(date +%s%N)
+    ns=$((t1 - t0))
+    if ((best == 0 || ns < best)); then best=$ns; fi
+  done
+  awk -v b="$SIZE_MB" -v ns="$best" 'BEGIN { printf "%7.0f MB/s", b * 1048576 / ns * 1000 }'
+}
+
+# stages(N, MID): "cat -u SRC | MID | ... " with N stages in all
+stages() {
+  local line="cat -u $SRC" mid
+  for ((s = 1; s < $1; s++)); do
+    if [[ $2 == mixed && $((s % 2)) == 1 ]]; then mid="cat"; else mid="cat -u"; fi
+    line+=" | $mid"
+  done
+  printf '%s' "$line"
+}
+
+ts_run() { "$TS" -c "set pipesize $1
+$2"; }
+sh_run() { bash -c "$1"; }
+
+printf "%-9s %14s %14s %14s %14s   (%d MB, best of %d)\n" \
+  "stages" "default" "64K" "1M" "bash" "$SIZE_MB" "$RUNS"
+for kind in plain mixed; do
+  for n in 2 3 5; do
+    line="$(stages "$n" "$kind")"
+    label="$n"
+    [[ $kind == mixed ]] && label="$n mixed"
+    printf "%-9s %14s %14s %14s %14s\n" "$label" \
+      "$(best_mbs ts_run 0 "$line")" "$(best_mbs ts_run 64K "$line")" \
+      "$(best_mbs ts_run 1M "$line")" "$(best_mbs sh_run "$line")"
+  done
+done
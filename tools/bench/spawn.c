@@ -0,0 +1,89 @@
+/*
+  spawn.c - command start latency against the shell's resident size.
+
+  Builds the shell into the harness and times start-to-reap of /bin/true
+  through three paths while the parent holds 8 MB to 1 GB of touched
+  heap, which is what a long interactive session with a large arena or
+  history looks like to the kernel:
+    fork+exec    what the shell did before posix_spawn
+    posix_spawn  spawn_proc() with no zygote (the default path)
+    zygote       spawn_proc() via the zygote forked at startup
+                 (TRADE_ZYGOTE=1), before the heap grew
+
+    gcc -O2 -pthread -o /tmp/bench_spawn tools/bench/spawn.c
+    /tmp/bench_spawn [N] [MB...]      # default 200 runs, 8 256 1024 MB
+
+  fork+exec should grow with RSS (page tables are copied); the other two
+  should stay flat.
+*/
+#define main tradeshell_main
+#include "../../src/tradeshell.c"
+#undef main
+
+static char *g_true_argv[] = { "/bin/true", NULL };
+
+static double now_us(void)
+{
+  return (double)mono_ns() / 1e3;
+}
+
+static double run_fork(int n)
+{
+  double t0 = now_us();
+  for (int i = 0; i < n; i++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      execv(g_true_argv[0], g_true_argv);
+      _exit(127);
+    }
+    if (pid < 0) { perror("fork"); exit(1); }
+    waitpid(pid, NULL, 0);
+  }
+  return (now_us() - t0) / n;
+}
+
+static double run_spawn_proc(int n)
+{
+  spawn_req r = { .argv = g_true_argv, .fd_in = -1, .fd_out = -1, .fd_err = -1 };
+  double t0 = now_us();
+  for (int i = 0; i < n; i++) {
+    struct rusage ru;
+    if (proc_wait(spawn_proc(&r), &ru) != 0) { fprintf(stderr, "spawn failed\n"); exit(1); }
+  }
+  return (now_us() - t0) / n;
+}
+
+int main(int argc, char **argv)
+{
+  int n = argc > 1 ? atoi(argv[1]) : 200;
+  static const size_t def_mb[] = { 8, 256, 1024 };
+  int nmb = argc > 2 ? argc - 2 : 3;
+
+  // as in the shell: the zygote is forked before anything grows
+  setenv("TRADE_ZYGOTE", "1", 1);
+  zygote_start();
+  int zy_fd = g_zy.fd;
+  if (zy_fd < 0) fprintf(stderr, "zygote did not start; skipping that column\n");
+
+  printf("%8s %12s %12s %12s   (us per start+reap, %d runs)\n",
+         "RSS", "fork+exec", "posix_spawn", "zygote", n);
+  for (int k = 0; k < nmb; k++) {
+    size_t mb = argc > 2 ? (size_t)atol(argv[k + 2]) : def_mb[k];
+    // 4 KB pages, as a heap of small arena and history blocks would be;
+    // transparent huge pages would hide most of the page-table copy
+    char *heap = mmap(NULL, mb << 20, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (heap == MAP_FAILED) { perror("mmap"); return 1; }
+    (void)madvise(heap, mb << 20, MADV_NOHUGEPAGE);
+    memset(heap, 1, mb << 20);
+
+    double t_fork = run_fork(n);
+    g_zy.fd = -1;
+    double t_spawn = run_spawn_proc(n);
+    g_zy.fd = zy_fd;
+    double t_zy = zy_fd >= 0 ? run_spawn_proc(n) : 0;
+
+    printf("%6zuMB %12.1f %12.1f %12.1f\n", mb, t_fork, t_spawn, t_zy);
+    munmap(heap, mb << 20);
+  }
+  return 0;
+}
@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+"""Generate cmd_lookup() in tradeshell.c from cmd_table.
+
+The lookup is a switch on the name's length, then on as few of its bytes
+as it takes to tell the names of that length apart; the final strcmp in
+cmd_lookup() is the only string compare. The switch lives between the
+BEGIN/END generated markers and is rewritten in place:
+
+    python3 tools/gen_cmd_lookup.py src/tradeshell.c          # regenerate
+    python3 tools/gen_cmd_lookup.py --check src/tradeshell.c  # fail if stale
+
+src/Compile.sh runs --check before compiling (with platform-python where
+there is no python3), so a command added to the table without
+regenerating the lookup fails the build. tests/cmd_lookup checks that
+every name in the table looks up to its own entry.
+"""
+import re
+import sys
+
+BEGIN = "  // BEGIN generated by tools/gen_cmd_lookup.py from cmd_table; do not edit\n"
+END = "  // END generated\n"
+
+
+def die(msg):
+    print("gen_cmd_lookup: " + msg, file=sys.stderr)
+    sys.exit(1)
+
+
+def parse(src):
+    m = re.search(r"typedef enum \{([^}]*)\} cmd_id;", src)
+    if not m:
+        die("cmd_id enum not found")
+    ids = [x for x in re.findall(r"\bCMD_\w+", m.group(1)) if x != "CMD_NCOMMANDS"]
+
+    m = re.search(r"static const cmd_entry cmd_table\[CMD_NCOMMANDS\] = \{(.*?)\n\};", src, re.S)
+    if not m:
+        die("cmd_table not found")
+    table = m.group(1)
+    entries = re.findall(r"\b(?:BUILTIN|SERVICE|EXEC|EXEC_NATIVE)\(\s*(CMD_\w+),\s*\"([^\"]+)\"", table)
+    entries += re.findall(r"\[(CMD_\w+)\]\s*=\s*\{\s*\.name\s*=\s*\"([^\"]+)\"", table)
+
+    seen_ids, seen_names = set(), set()
+    for cid, name in entries:
+        if cid in seen_ids:
+            die("%s appears twice in cmd_table" % cid)
+        if name in seen_names:
+            die("command name \"%s\" appears twice in cmd_table" % name)
+        seen_ids.add(cid)
+        seen_names.add(name)
+    missing = [x for x in ids if x not in seen_ids]
+    if missing:
+        die("no cmd_table entry for " + ", ".join(missing))
+    extra = [x for x in seen_ids if x not in ids]
+    if extra:
+        die("cmd_table entries not in cmd_id: " + ", ".join(sorted(extra)))
+    order = {cid: i for i, cid in enumerate(ids)}
+    return sorted(entries, key=lambda e: order[e[0]])
+
+
+def emit(out, entries, indent, used):
+    pad = "  " * indent
+    if len(entries) == 1:
+        out.append("%sid = %s; break;\n" % (pad, entries[0][0]))
+        return
+    # Switch on the byte that splits the group into the most cases.
+    n = min(len(name) for _, name in entries)
+    best = max((i for i in range(n) if i not in used),
+               key=lambda i: (len({name[i] for _, name in entries}), -i))
+    groups = {}
+    for cid, name in entries:
+        groups.setdefault(name[best], []).append((cid, name))
+    out.append("%sswitch (name[%d]) {\n" % (pad, best))
+    for ch, group in groups.items():
+        if len(group) == 1:
+            out.append("%scase '%s': id = %s; break;\n" % (pad, ch, group[0][0]))
+        else:
+            out.append("%scase '%s':\n" % (pad, ch))
+            emit(out, group, indent + 1, used | {best})
+    out.append("%s}\n" % pad)
+    out.append("%sbreak;\n" % pad)
+
+
+def generate(entries):
+    by_len = {}
+    for cid, name in entries:
+        by_len.setdefault(len(name), []).append((cid, name))
+    out = ["  switch (strlen(name)) {\n"]
+    for n in sorted(by_len):
+        out.append("  case %d:\n" % n)
+        emit(out, by_len[n], 2, frozenset())
+    out.append("  }\n")
+    return "".join(out)
+
+
+def main(argv):
+    check = "--check" in argv
+    paths = [a for a in argv if a != "--check"]
+    if len(paths) != 1:
+        die("usage: gen_cmd_lookup.py [--check] tradeshell.c")
+    path = paths[0]
+    with open(path, encoding="utf-8") as f:
+        src = f.read()
+
+    b, e = src.find(BEGIN), src.find(END)
+    if b < 0 or e < b:
+        die("generated markers not found in " + path)
+    body = generate(parse(src))
+    if src[b + len(BEGIN):e] == body:
+        return 0
+    if check:
+        die("cmd_lookup() is out of date with cmd_table; run tools/gen_cmd_lookup.py " + path)
+    with open(path, "w", encoding="utf-8") as f:
+        f.write(src[:b + len(BEGIN)] + body + src[e:])
+    print("gen_cmd_lookup: updated " + path)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))